@@ -1,55 +1,12 @@
-#include <errno.h>
-#include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <sys/types.h>
 
-#define COL_USERNAME_SIZE 32
-#define COL_EMAIL_SIZE 255
+#include "db.h"
 
-#define INVALID_PAGE_NUM UINT32_MAX
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
-
-typedef struct
-{
-    uint32_t id;
-    char username[COL_USERNAME_SIZE + 1];
-    char email[COL_EMAIL_SIZE + 1];
-} Row;
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
-
-const uint32_t PAGE_SIZE = 4096;
-
-#define TABLE_MAX_PAGES 100
-typedef struct
-{
-    int file_descriptor;
-    uint32_t file_length;
-    uint32_t num_pages;
-    void *pages[TABLE_MAX_PAGES];
-} Pager;
-typedef struct
-{
-    uint32_t root_page_num;
-    Pager *pager;
-} Table;
-typedef struct
-{
-    Table *table;
-    uint32_t page_num;
-    uint32_t cell_num;
-    bool end_of_table;
-} Cursor;
 typedef struct
 {
     char *buffer;
@@ -74,8 +31,8 @@ typedef enum
 {
     EXECUTE_SUCCESS,
     EXECUTE_TABLE_FULL,
-    EXECUTE_DUPLICATE_KEY
-
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_READ_ONLY
 } ExecuteResult;
 typedef enum
 {
@@ -83,330 +40,27 @@ typedef enum
     INSERT_STATEMENT
 } StatementType;
 
+typedef enum
+{
+    AGGREGATE_NONE,
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_RANK
+} AggregateType;
+
 typedef struct
 {
     StatementType type;
+    AggregateType aggregate;
+    bool ordered;
+    DbColumn order_by;
+    uint32_t limit;
+    uint32_t offset;
+    uint32_t rank_id;
     Row row_to_insert;
 } Statement;
 
-typedef enum
-{
-    NODE_INTERNAL,
-    NODE_LEAF
-} NodeType;
-
-const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
-const uint32_t NODE_TYPE_OFFSET = 0;
-const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
-const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE =
-    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
-
-const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
-    INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                           INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
-
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE =
-    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-const uint32_t INTERNAL_NODE_MAX_KEYS = 3;
-
-const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
-    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                       LEAF_NODE_NUM_CELLS_SIZE +
-                                       LEAF_NODE_NEXT_LEAF_SIZE;
-
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS =
-    LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
-uint32_t *leaf_node_num_cells(void *node)
-{
-    return node + LEAF_NODE_NUM_CELLS_OFFSET;
-}
-void *leaf_node_cell(void *node, uint32_t cell_num)
-{
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
-}
-uint32_t *leaf_node_key(void *node, uint32_t cell_num)
-{
-    return leaf_node_cell(node, cell_num);
-}
-void *leaf_node_value(void *node, uint32_t cell_num)
-{
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
-}
-void set_node_type(void *node, NodeType type)
-{
-    uint8_t value = type;
-    *((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
-}
-void set_root_node(void *node, bool is_root)
-{
-    uint8_t value = is_root;
-    *((uint32_t *)(node + IS_ROOT_OFFSET)) = value;
-}
-uint32_t *node_parent(void *node)
-{
-    return node + PARENT_POINTER_OFFSET;
-}
-uint32_t *leaf_node_next_leaf(void *node)
-{
-    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
-}
-void *initialize_leaf_node(void *node)
-{
-    memset(node, 0, PAGE_SIZE);
-    set_node_type(node, NODE_LEAF);
-    set_root_node(node, false);
-    *leaf_node_num_cells(node) = 0;
-    *leaf_node_next_leaf(node) = 0;
-}
-
-uint32_t *internal_node_num_key(void *node)
-{
-    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
-}
-uint32_t *internal_node_right_child(void *node)
-{
-    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
-}
-void *initialize_internal_node(void *node)
-{
-    set_node_type(node, NODE_INTERNAL);
-    set_root_node(node, false);
-    *internal_node_num_key(node) = 0;
-    *internal_node_right_child(node) = INVALID_PAGE_NUM;
-}
-
-uint32_t *internal_node_cell(void *node, uint32_t cell_num)
-{
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
-}
-
-uint32_t *internal_node_child(void *node, uint32_t child_num)
-{
-    uint32_t num_keys = *internal_node_num_key(node);
-    if (child_num > num_keys)
-    {
-        printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
-        exit(EXIT_FAILURE);
-    }
-    else if (child_num == num_keys)
-    {
-        uint32_t *right_child = internal_node_right_child(node);
-        if (*right_child == INVALID_PAGE_NUM)
-        {
-            printf("Tried to access right child of node, but was invalid page\n");
-            exit(EXIT_FAILURE);
-        }
-        return right_child;
-    }
-    else
-    {
-        uint32_t *child = internal_node_cell(node, child_num);
-        if (*child == INVALID_PAGE_NUM)
-        {
-            printf("Tried to access right child of node, but was invalid page\n");
-            exit(EXIT_FAILURE);
-        }
-        return child;
-    }
-}
-uint32_t *internal_node_key(void *node, uint32_t key_num)
-{
-    return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
-}
-NodeType get_node_type(void *node)
-{
-    uint32_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
-
-    return (NodeType)value;
-}
-
-bool is_root_node(void *node)
-{
-    uint8_t value = *((uint32_t *)(node + IS_ROOT_OFFSET));
-    return value != 0;
-}
-
-void *get_page(Pager *pager, uint32_t page_num)
-{
-    if (page_num > TABLE_MAX_PAGES)
-    {
-        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
-               TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
-
-    if (pager->pages[page_num] == NULL)
-    {
-        void *page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-        if (pager->file_length % PAGE_SIZE)
-        {
-            num_pages += 1;
-        }
-
-        if (page_num <= num_pages)
-
-        {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1)
-            {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
-        pager->pages[page_num] = page;
-        if (page_num >= pager->num_pages)
-        {
-            pager->num_pages = page_num + 1;
-        }
-    }
-    return pager->pages[page_num];
-}
-uint32_t get_node_max_key(Pager *pager, void *node)
-{
-    switch (get_node_type(node))
-    {
-    case NODE_INTERNAL:
-        void *right_child = get_page(pager, *internal_node_right_child(node));
-        return get_node_max_key(pager, right_child);
-    case NODE_LEAF:
-        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
-    }
-}
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
-{
-    void *node = get_page(table->pager, page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    Cursor *cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = page_num;
-
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index)
-    {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index)
-        {
-            cursor->cell_num = index;
-            return cursor;
-        }
-        if (key < key_at_index)
-        {
-            one_past_max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
-    }
-    cursor->cell_num = min_index;
-    return cursor;
-}
-
-void print_constants()
-{
-    printf("Constants:\n");
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
-    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
-}
-
-uint32_t internal_node_find_child(void *node, uint32_t key)
-{
-    uint32_t num_keys = *internal_node_num_key(node);
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys;
-
-    while (max_index != min_index)
-    {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-
-        if (key <= key_to_right)
-        {
-            max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
-    }
-    return min_index;
-}
-uint32_t *update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key)
-{
-    uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
-}
-Cursor *internal_node_find(Table *table, uint32_t key, uint32_t page_num)
-{
-    void *node = get_page(table->pager, page_num);
-    uint32_t child_index = internal_node_find_child(node, key);
-    uint32_t child_num = *internal_node_child(node, child_index);
-    void *child = get_page(table->pager, child_num);
-
-    switch (get_node_type(child))
-    {
-    case NODE_LEAF:
-        return leaf_node_find(table, child_num, key);
-    case NODE_INTERNAL:
-        return internal_node_find(table, child_num, key);
-    default:
-        exit(EXIT_FAILURE);
-    }
-}
-Cursor *table_find(Table *table, uint32_t key)
-{
-    uint32_t root_page_num = table->root_page_num;
-    void *root_node = get_page(table->pager, root_page_num);
-    if (get_node_type(root_node) == NODE_LEAF)
-    {
-        return leaf_node_find(table, root_page_num, key);
-    }
-    else
-    {
-        return internal_node_find(table, root_page_num, key);
-    }
-}
-Cursor *table_start(Table *table)
-{
-    Cursor *cursor = table_find(table, 0);
-    void *node = get_page(table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    cursor->end_of_table = (num_cells == 0);
-    return cursor;
-}
-
 InputBuffer *
 new_input_buffer()
 {
@@ -416,491 +70,230 @@ new_input_buffer()
     input_buffer->input_length = 0;
     return input_buffer;
 }
-void serialize_row(Row *source, void *destination)
+void print_prompt()
 {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+    printf("db>");
 }
-void deserialize_row(void *source, Row *destination)
+void print_row(Row *row)
 {
-    memcpy(&(destination->id), (source + ID_OFFSET), ID_SIZE);
-    memcpy(&(destination->username), (source + USERNAME_OFFSET), USERNAME_SIZE);
-    memcpy(&(destination->email), (source + EMAIL_OFFSET), EMAIL_SIZE);
+    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
 }
-
-Pager *pager_open(const char *filename)
+void read_input(InputBuffer *inputBuffer)
 {
-
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-    if (fd == -1)
-    {
-        printf("Unable to open the file.\n");
-        exit(EXIT_FAILURE);
-    }
-    off_t file_length = lseek(fd, 0, SEEK_END);
-    Pager *pager = malloc(sizeof(Pager));
-    pager->file_descriptor = fd;
-    pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
-    if (file_length % PAGE_SIZE != 0)
+    ssize_t bytes_read = getline(&(inputBuffer->buffer), &(inputBuffer->buffer_length), stdin);
+    if (bytes_read <= 0)
     {
-        printf("Corrupt file. \n");
+        printf("error in reading\n");
         exit(EXIT_FAILURE);
     }
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
-    {
-        pager->pages[i] = NULL;
-    }
-    return pager;
-}
-
-Table *db_open(const char *fileName)
-{
-
-    Pager *pager = pager_open(fileName);
-    Table *table = malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
-    if (pager->num_pages == 0)
-    {
-        void *root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_root_node(root_node, true);
-    }
-    return table;
+    inputBuffer->buffer[bytes_read - 1] = 0;
+    inputBuffer->input_length = bytes_read - 1;
 }
 
-uint32_t get_unused_pages(Pager *pager)
+void close_input_buffer(InputBuffer *inputBuffer)
 {
-    return pager->num_pages;
+    free(inputBuffer->buffer);
+    free(inputBuffer);
 }
-
-void create_new_root_node(Table *table, uint32_t right_child_page_num)
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table)
 {
-
-    void *root = get_page(table->pager, table->root_page_num);
-
-    void *right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_pages(table->pager);
-    void *left_child = get_page(table->pager, left_child_page_num);
-    if (get_node_type(root) == NODE_INTERNAL)
+    if (strcmp(input_buffer->buffer, ".exit") == 0)
     {
-        initialize_internal_node(right_child);
-        initialize_internal_node(left_child);
+        db_close(table);
+        exit(EXIT_SUCCESS);
     }
-    memcpy(left_child, root, PAGE_SIZE);
-    set_root_node(left_child, false);
-
-    if (get_node_type(left_child) == NODE_INTERNAL)
+    else if (strcmp(input_buffer->buffer, ".constants") == 0)
     {
-        void *child;
-        for (int i = 0; i < *internal_node_num_key(left_child); i++)
-        {
-            child = get_page(table->pager, *internal_node_child(left_child, i));
-            *node_parent(child) = left_child_page_num;
-        }
-        child = get_page(table->pager, *internal_node_right_child(left_child));
-        *node_parent(child) = left_child_page_num;
+        db_print_constants(table);
+        return META_COMMAND_SUCCESS;
     }
-
-    initialize_internal_node(root);
-    set_root_node(root, true);
-    *internal_node_num_key(root) = 1;
-
-    *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
-    *node_parent(left_child) = table->root_page_num;
-    *node_parent(right_child) = table->root_page_num;
-}
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
-void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
-{
-    void *parent = get_page(table->pager, parent_page_num);
-    void *child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
-    uint32_t index = internal_node_find_child(parent, child_max_key);
-    uint32_t original_num_keys = *internal_node_num_key(parent);
-    if (original_num_keys >= INTERNAL_NODE_MAX_KEYS)
+    else if (strcmp(input_buffer->buffer, ".btree") == 0)
     {
-        internal_node_split_and_insert(table, parent_page_num, child_page_num);
-        return;
+        printf("Tree:\n");
+        db_print_tree(table);
+        return META_COMMAND_SUCCESS;
     }
-
-    uint32_t right_child_page_num = *internal_node_right_child(parent);
-    if (right_child_page_num == INVALID_PAGE_NUM)
+    else if (strcmp(input_buffer->buffer, ".trace on") == 0)
     {
-        *internal_node_right_child(parent) = child_page_num;
-        return;
+        db_trace_enable(true);
+        return META_COMMAND_SUCCESS;
     }
-    *internal_node_num_key(parent) = original_num_keys + 1;
-    void *right_child = get_page(table->pager, right_child_page_num);
-    if (child_max_key > get_node_max_key(table->pager, right_child))
+    else if (strcmp(input_buffer->buffer, ".trace off") == 0)
     {
-        *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) = get_node_max_key(table->pager, right_child);
-        *internal_node_right_child(parent) = child_page_num;
+        db_trace_enable(false);
+        return META_COMMAND_SUCCESS;
     }
-    else
+    else if (strcmp(input_buffer->buffer, ".trace dump") == 0)
     {
-        for (uint32_t i = original_num_keys; i > index; i--)
-        {
-            void *source = internal_node_cell(parent, i - 1);
-            void *destination = internal_node_cell(parent, i);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
+        db_trace_dump();
+        return META_COMMAND_SUCCESS;
     }
-}
-
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value)
-{
-
-    void *old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
-    uint32_t new_page_num = get_unused_pages(cursor->table->pager);
-    void *new_node = get_page(cursor->table->pager, new_page_num);
-    initialize_leaf_node(new_node);
-    *node_parent(old_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
-
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--)
+    else if (strcmp(input_buffer->buffer, ".checkpoint") == 0)
     {
-        void *destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT)
-        {
-            destination_node = new_node;
-        }
-        else
-        {
-            destination_node = old_node;
-        }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void *destination = leaf_node_cell(destination_node, index_within_node);
-        if (i == cursor->cell_num)
+        db_checkpoint(table);
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strncmp(input_buffer->buffer, ".vacuum", 7) == 0)
+    {
+        uint32_t fill_percent = 100;
+        if (input_buffer->buffer[7] == ' ')
         {
-            serialize_row(value, leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
+            fill_percent = atoi(input_buffer->buffer + 8);
         }
-        else if (i > cursor->cell_num)
+        else if (input_buffer->buffer[7] != '\0')
         {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
         }
-        else
+        if (fill_percent == 0 || fill_percent > 100)
         {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            printf("Fill factor must be between 1 and 100.\n");
+            return META_COMMAND_SUCCESS;
         }
-
-        *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-        *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-        if (is_root_node(old_node))
+        uint32_t num_pages;
+        switch (db_vacuum(table, fill_percent, &num_pages))
         {
-            return create_new_root_node(cursor->table, new_page_num);
-        }
-        else
-        {
-            uint32_t parent_page_num = *node_parent(old_node);
-            uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
-            void *parent = get_page(cursor->table->pager, parent_page_num);
-            update_internal_node_key(parent, old_max, new_max);
-            internal_node_insert(cursor->table, parent_page_num, new_page_num);
-            return;
+        case DB_READ_ONLY:
+            printf("Read-only replica.\n");
+            break;
+        case DB_TABLE_FULL:
+            printf("Vacuum needs %d pages, more than the table can hold.\n", num_pages);
+            break;
+        default:
+            printf("Vacuumed %d rows into %d pages.\n", db_count(table), num_pages);
+            break;
         }
+        return META_COMMAND_SUCCESS;
     }
-}
-
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value)
-{
-    void *node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-
-    if (num_cells >= LEAF_NODE_MAX_CELLS)
-    {
-
-        printf("Leaf node full, splitting...\n");
-        leaf_node_split_and_insert(cursor, key, value);
-        return;
-    }
-
-    if (cursor->cell_num < num_cells)
+    else
     {
-
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--)
-        {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
-
-    printf("Inserted key %d at cell %d\n", key, cursor->cell_num);
 }
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
+PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement)
 {
-    uint32_t old_page_num = parent_page_num;
-    void *old_node = get_page(table->pager, parent_page_num);
-    uint32_t old_max = get_node_max_key(table->pager, old_node);
-
-    void *child = get_page(table->pager, child_page_num);
-    uint32_t child_max = get_node_max_key(table->pager, child);
-
-    uint32_t new_page_num = get_unused_pages(table->pager);
-    uint32_t splitting_root_node = is_root_node(old_node);
-
-    void *parent;
-    void *new_node;
-    if (splitting_root_node)
+    statement->type = INSERT_STATEMENT;
+    const char *keyword = strtok(input_buffer->buffer, " ");
+    const char *id_STRING = strtok(NULL, " ");
+    const char *username = strtok(NULL, " ");
+    const char *email = strtok(NULL, " ");
+    if (id_STRING == NULL || username == NULL || email == NULL)
     {
-        create_new_root_node(table, new_page_num);
-        parent = get_page(table->pager, table->root_page_num);
-        old_page_num = *internal_node_child(parent, 0);
-        old_node = get_page(table->pager, old_page_num);
+        return PREPARE_SYNTAX_ERROR;
     }
-    else
+    int id = atoi(id_STRING);
+    if (id < 0)
     {
-        parent = get_page(table->pager, *node_parent(old_node));
-        new_node = get_page(table->pager, new_page_num);
-        initialize_internal_node(new_node);
+        return PREPARE_NEGATIVE_ID;
     }
-
-    uint32_t *old_num_keys = internal_node_num_key(old_node);
-    uint32_t cur_page_num = *internal_node_right_child(old_node);
-    void *cur = get_page(table->pager, cur_page_num);
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
-    *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-    for (int i = INTERNAL_NODE_MAX_KEYS - 1; i > INTERNAL_NODE_MAX_KEYS / 2; i--)
+    if (strlen(username) >= COL_USERNAME_SIZE)
     {
-        cur_page_num = *internal_node_child(old_node, i);
-        cur = get_page(table->pager, cur_page_num);
-        internal_node_insert(table, new_page_num, cur_page_num);
-        *node_parent(cur) = new_page_num;
-        (*old_num_keys)--;
+        return PREPARE_STRING_TOO_LONG;
     }
-
-    *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
-    (*old_num_keys)--;
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
-    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
-    internal_node_insert(table, destination_page_num, child_page_num);
-    *node_parent(child) = destination_page_num;
-    update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
-    if (!splitting_root_node)
+    if (strlen(email) >= COL_EMAIL_SIZE)
     {
-        internal_node_insert(table, *node_parent(old_node), new_page_num);
-        *node_parent(new_node) = *node_parent(old_node);
+        return PREPARE_STRING_TOO_LONG;
     }
+    statement->row_to_insert.id = id;
+    strcpy(statement->row_to_insert.username, username);
+    strcpy(statement->row_to_insert.email, email);
+    return PREPARE_SUCCESS;
 }
-void *pager_flush(Pager *pager, uint32_t page_num)
+bool parse_column(const char *name, DbColumn *column)
 {
-    if (pager->pages[page_num] == NULL)
+    if (strcmp(name, "id") == 0)
     {
-        printf("tried to flush empty page");
-        exit(EXIT_FAILURE);
+        *column = DB_COLUMN_ID;
     }
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1)
+    else if (strcmp(name, "username") == 0)
     {
-        printf("Error seeking.\n");
-        exit(EXIT_FAILURE);
+        *column = DB_COLUMN_USERNAME;
     }
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1)
+    else if (strcmp(name, "email") == 0)
     {
-        printf("error in writing.\n");
-        exit(EXIT_FAILURE);
+        *column = DB_COLUMN_EMAIL;
+    }
+    else
+    {
+        return false;
     }
+    return true;
 }
-void *db_close(Table *table)
+PrepareResult prepare_select(InputBuffer *input_buffer, Statement *statement)
 {
-    Pager *pager = table->pager;
-    for (uint32_t i = 0; i < pager->num_pages; i++)
+    statement->type = SELECT_STATEMENT;
+    statement->aggregate = AGGREGATE_NONE;
+    statement->ordered = false;
+    statement->limit = 0;
+    statement->offset = 0;
+    strtok(input_buffer->buffer, " ");
+    const char *token = strtok(NULL, " ");
+    if (token == NULL)
     {
-        if (pager->pages[i] == NULL)
-        {
-            continue;
-        }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+        return PREPARE_SUCCESS;
     }
-
-    int result = close(pager->file_descriptor);
-    if (result == -1)
+    if (strcmp(token, "count(*)") == 0)
     {
-        printf("error in clsoing.\n");
-        exit(EXIT_FAILURE);
+        statement->aggregate = AGGREGATE_COUNT;
     }
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    else if (strcmp(token, "min(id)") == 0)
     {
-        void *page = pager->pages[i];
-        if (page)
-        {
-            free(page);
-            pager->pages[i] = NULL;
-        }
+        statement->aggregate = AGGREGATE_MIN;
     }
-    free(pager);
-    free(table);
-}
-void free_table(Table *table)
-{
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    else if (strcmp(token, "max(id)") == 0)
     {
-        free(table->pager->pages[i]);
+        statement->aggregate = AGGREGATE_MAX;
     }
-    free(table);
-}
-void print_prompt()
-{
-    printf("db>");
-}
-void print_row(Row *row)
-{
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
-}
-void read_input(InputBuffer *inputBuffer)
-{
-    ssize_t bytes_read = getline(&(inputBuffer->buffer), &(inputBuffer->buffer_length), stdin);
-    if (bytes_read <= 0)
+    else if (strcmp(token, "rank") == 0)
     {
-        printf("error in reading\n");
-        exit(EXIT_FAILURE);
+        const char *id = strtok(NULL, " ");
+        if (id == NULL || atoi(id) < 0)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->aggregate = AGGREGATE_RANK;
+        statement->rank_id = atoi(id);
     }
-    inputBuffer->buffer[bytes_read - 1] = 0;
-    inputBuffer->input_length = bytes_read - 1;
-}
-
-void close_input_buffer(InputBuffer *inputBuffer)
-{
-    free(inputBuffer->buffer);
-    free(inputBuffer);
-}
-void indent(uint32_t level)
-{
-    for (uint32_t i = 0; i < level; i++)
+    if (statement->aggregate != AGGREGATE_NONE)
     {
-        printf("  ");
+        return strtok(NULL, " ") == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
     }
-}
-void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
-{
-    void *node = get_page(pager, page_num);
-    uint32_t num_keys, child;
 
-    switch (get_node_type(node))
+    if (strcmp(token, "order") == 0)
     {
-    case NODE_LEAF:
-        num_keys = *leaf_node_num_cells(node);
-        indent(indentation_level);
-        printf("- leaf (size %d)\n", num_keys);
-
-        for (uint32_t i = 0; i < num_keys; i++)
+        const char *by = strtok(NULL, " ");
+        const char *column = strtok(NULL, " ");
+        if (by == NULL || strcmp(by, "by") != 0 || column == NULL ||
+            !parse_column(column, &statement->order_by))
         {
-            indent(indentation_level + 1);
-            printf("- %d\n", *leaf_node_key(node, i));
+            return PREPARE_SYNTAX_ERROR;
         }
-        break;
-
-    case NODE_INTERNAL:
-        num_keys = *internal_node_num_key(node);
-        indent(indentation_level);
-        printf("- internal (size %d)\n", num_keys);
-
-        if (num_keys > 0)
-        {
-            for (uint32_t i = 0; i < num_keys; i++)
-            {
-                child = *internal_node_child(node, i);
-                print_tree(pager, child, indentation_level + 1);
-            }
-        }
-        break;
+        statement->ordered = true;
+        token = strtok(NULL, " ");
     }
-}
-
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table)
-{
-    if (strcmp(input_buffer->buffer, ".exit") == 0)
-    {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    }
-    else if (strcmp(input_buffer->buffer, ".constants") == 0)
-    {
-        print_constants();
-        return META_COMMAND_SUCCESS;
-    }
-    else if (strcmp(input_buffer->buffer, ".btree") == 0)
-    {
-        printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
-        return META_COMMAND_SUCCESS;
-    }
-    else
+    if (token != NULL && strcmp(token, "limit") == 0)
     {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
-    }
-}
-void *cursor_value(Cursor *cursor)
-{
-    uint32_t page_num = cursor->page_num;
-    void *page = get_page(cursor->table->pager, page_num);
-    return leaf_node_value(page, cursor->cell_num);
-}
-void cursor_advance(Cursor *cursor)
-{
-    uint32_t page_num = cursor->page_num;
-    void *node = get_page(cursor->table->pager, page_num);
-    cursor->cell_num += 1;
-
-    if (cursor->cell_num >= (*leaf_node_num_cells(node)))
-    {
-        uint32_t next_page_num = *leaf_node_next_leaf(node);
-        if (next_page_num == 0)
+        const char *limit = strtok(NULL, " ");
+        if (limit == NULL || atoi(limit) <= 0)
         {
-            cursor->end_of_table = true;
+            return PREPARE_SYNTAX_ERROR;
         }
-        else
+        statement->limit = atoi(limit);
+        token = strtok(NULL, " ");
+    }
+    if (token != NULL && strcmp(token, "offset") == 0)
+    {
+        const char *offset = strtok(NULL, " ");
+        if (offset == NULL || atoi(offset) < 0)
         {
-            cursor->page_num = next_page_num;
-            cursor->cell_num = 0;
+            return PREPARE_SYNTAX_ERROR;
         }
+        statement->offset = atoi(offset);
+        token = strtok(NULL, " ");
     }
-}
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement)
-{
-    statement->type = INSERT_STATEMENT;
-    const char *keyword = strtok(input_buffer->buffer, " ");
-    const char *id_STRING = strtok(NULL, " ");
-    const char *username = strtok(NULL, " ");
-    const char *email = strtok(NULL, " ");
-    if (id_STRING == NULL || username == NULL || email == NULL)
+    if (token != NULL)
     {
         return PREPARE_SYNTAX_ERROR;
     }
-    int id = atoi(id_STRING);
-    if (id < 0)
-    {
-        return PREPARE_NEGATIVE_ID;
-    }
-    if (strlen(username) >= COL_USERNAME_SIZE)
-    {
-        return PREPARE_STRING_TOO_LONG;
-    }
-    if (strlen(email) >= COL_EMAIL_SIZE)
-    {
-        return PREPARE_STRING_TOO_LONG;
-    }
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
     return PREPARE_SUCCESS;
 }
 PrepareResult prepare_statement(InputBuffer *inputBuffer, Statement *statement)
@@ -913,8 +306,7 @@ PrepareResult prepare_statement(InputBuffer *inputBuffer, Statement *statement)
     else if (strncmp(inputBuffer->buffer, "select", 6) == 0)
     {
 
-        statement->type = SELECT_STATEMENT;
-        return PREPARE_SUCCESS;
+        return prepare_select(inputBuffer, statement);
     }
     else
     {
@@ -923,41 +315,98 @@ PrepareResult prepare_statement(InputBuffer *inputBuffer, Statement *statement)
 }
 ExecuteResult execute_insert(Statement *statement, Table *table)
 {
-    Row *row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor *cursor = table_find(table, key_to_insert);
-
-    void *node = get_page(table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-
-    if (cursor->cell_num < num_cells)
+    DbInsertInfo info;
+    switch (db_insert(table, &(statement->row_to_insert), &info))
     {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert)
+    case DB_DUPLICATE_KEY:
+        printf("Duplicate key error: %d\n", statement->row_to_insert.id);
+        return EXECUTE_DUPLICATE_KEY;
+    case DB_READ_ONLY:
+        return EXECUTE_READ_ONLY;
+    default:
+        if (info.split)
         {
-            printf("Duplicate key error: %d\n", key_to_insert);
-
-            return EXECUTE_DUPLICATE_KEY;
+            printf("Leaf node full, splitting...\n");
         }
+        else
+        {
+            printf("Inserted key %d at cell %d\n", statement->row_to_insert.id, info.cell_num);
+        }
+        return EXECUTE_SUCCESS;
+    }
+}
+ExecuteResult execute_aggregate(Statement *statement, Table *table)
+{
+    uint32_t id;
+    switch (statement->aggregate)
+    {
+    case AGGREGATE_COUNT:
+        printf("(%d)\n", db_count(table));
+        break;
+    case AGGREGATE_MIN:
+        if (db_min_id(table, &id) == DB_OK)
+        {
+            printf("(%d)\n", id);
+        }
+        else
+        {
+            printf("(null)\n");
+        }
+        break;
+    case AGGREGATE_MAX:
+        if (db_max_id(table, &id) == DB_OK)
+        {
+            printf("(%d)\n", id);
+        }
+        else
+        {
+            printf("(null)\n");
+        }
+        break;
+    case AGGREGATE_RANK:
+        if (db_rank(table, statement->rank_id, &id) == DB_OK)
+        {
+            printf("(%d)\n", id);
+        }
+        else
+        {
+            printf("(null)\n");
+        }
+        break;
+    default:
+        break;
     }
-
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-    free(cursor);
     return EXECUTE_SUCCESS;
 }
 ExecuteResult execute_select(Statement *statement, Table *table)
 {
-    Cursor *cursor = table_start(table);
+    if (statement->aggregate != AGGREGATE_NONE)
+    {
+        return execute_aggregate(statement, table);
+    }
     Row row;
-    while (!(cursor->end_of_table))
+    if (statement->ordered)
+    {
+        uint32_t limit = statement->limit == 0 ? 0 : statement->limit + statement->offset;
+        Sorter *sorter = db_sort(table, statement->order_by, limit);
+        for (uint32_t skipped = 0; skipped < statement->offset && db_sort_next(sorter, &row); skipped++)
+        {
+        }
+        while (db_sort_next(sorter, &row))
+        {
+            print_row(&(row));
+        }
+        db_sort_close(sorter);
+        return EXECUTE_SUCCESS;
+    }
+    Cursor *cursor = db_scan_position(table, statement->offset);
+    uint32_t printed = 0;
+    while ((statement->limit == 0 || printed < statement->limit) && db_cursor_next(cursor, &row))
     {
-
-        deserialize_row(cursor_value(cursor), &(row));
-
         print_row(&(row));
-
-        cursor_advance(cursor);
+        printed++;
     }
+    db_cursor_close(cursor);
     return EXECUTE_SUCCESS;
 }
 ExecuteResult execute_statement(Statement *statement, Table *table)
@@ -965,13 +414,11 @@ ExecuteResult execute_statement(Statement *statement, Table *table)
     switch (statement->type)
     {
     case SELECT_STATEMENT:
-        execute_select(statement, table);
-        break;
+        return execute_select(statement, table);
     case INSERT_STATEMENT:
-        execute_insert(statement, table);
-        break;
+        return execute_insert(statement, table);
     default:
-        break;
+        return EXECUTE_SUCCESS;
     }
 }
 
@@ -984,7 +431,45 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
     char *filename = argv[1];
-    Table *table = db_open(filename);
+    DbConfig config = {0};
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--compress") == 0)
+        {
+            config.compress = true;
+        }
+        else if (strcmp(argv[i], "--direct") == 0)
+        {
+            config.direct_io = true;
+        }
+        else if (strcmp(argv[i], "--flush-rate") == 0 && i + 1 < argc)
+        {
+            config.flush_rate = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc)
+        {
+            config.replicate_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc)
+        {
+            config.follow_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc)
+        {
+            config.page_size = atoi(argv[++i]);
+        }
+        else
+        {
+            printf("Unknown option '%s'.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    Table *table = db_open(filename, &config);
+    if (table == NULL)
+    {
+        printf("%s\n", db_open_error());
+        exit(EXIT_FAILURE);
+    }
     InputBuffer *inputBuffer = new_input_buffer();
     while (true)
     {
@@ -1003,7 +488,13 @@ int main(int argc, char *argv[])
             }
         }
         Statement statement;
-        switch (prepare_statement(inputBuffer, &statement))
+        db_statement_begin();
+        PrepareResult prepare_result = prepare_statement(inputBuffer, &statement);
+        if (prepare_result != PREPARE_SUCCESS)
+        {
+            db_statement_end();
+        }
+        switch (prepare_result)
         {
         case PREPARE_SUCCESS:
             break;
@@ -1020,7 +511,9 @@ int main(int argc, char *argv[])
             printf("Syntax error. Could not parse statement.\n");
             continue;
         }
-        switch (execute_statement(&statement, table))
+        ExecuteResult execute_result = execute_statement(&statement, table);
+        db_statement_end();
+        switch (execute_result)
         {
         case EXECUTE_SUCCESS:
             printf("Executed.\n");
@@ -1029,6 +522,10 @@ int main(int argc, char *argv[])
         case EXECUTE_DUPLICATE_KEY:
             printf("Key Already Exists.\n");
             break;
+
+        case EXECUTE_READ_ONLY:
+            printf("Read-only replica.\n");
+            break;
         }
     }
 }
@@ -0,0 +1,3038 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "db.h"
+
+#ifdef DB_ENABLE_SDT
+#include <sys/sdt.h>
+#define DB_PROBE(name, arg1, arg2) DTRACE_PROBE2(db, name, arg1, arg2)
+#else
+#define DB_PROBE(name, arg1, arg2)
+#endif
+
+#define INVALID_PAGE_NUM UINT32_MAX
+#define BTREE_MAX_DEPTH 16
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
+
+static const uint32_t ID_SIZE = size_of_attribute(Row, id);
+static const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+static const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
+
+static const uint32_t ID_OFFSET = 0;
+static const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
+static const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+static const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+
+#define DEFAULT_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+
+#define TABLE_MAX_PAGES 100
+
+#define PAGER_MAGIC "dbaCeDB"
+#define PAGER_MAGIC_SIZE 8
+#define PAGER_VERSION 5
+#define PAGER_MIN_VERSION 4
+#define LEGACY_PAGE_SIZE 4096
+#define PAGER_FLAG_COMPRESSED 1
+#define PAGER_SLOT_ALIGN 64
+#define PAGER_MAX_FREE_SLOTS (2 * TABLE_MAX_PAGES)
+#define PAGER_MAX_IOVECS 64
+#define PAGER_READ_AHEAD 8
+#define PAGER_IO_ALIGN 4096
+#define PAGER_FLUSH_INTERVAL_MS 100
+
+#define FRAME_ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+#define FRAME_ARENA_MAX_CHUNKS 8
+
+#define REPLICATION_MAX_FOLLOWERS 8
+#define REPLICATION_SEND_TIMEOUT_MS 1000
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+
+#define TRACE_RING_SIZE 4096
+
+#ifndef SORT_MEMORY_BUDGET
+#define SORT_MEMORY_BUDGET (1024 * 1024)
+#endif
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t capacity;
+} PageMapEntry;
+typedef struct
+{
+    char magic[PAGER_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t flags;
+    uint32_t num_pages;
+    PageMapEntry page_map[TABLE_MAX_PAGES];
+} FileHeader;
+_Static_assert(sizeof(FileHeader) <= DEFAULT_PAGE_SIZE, "the file header must fit in the smallest page");
+typedef struct
+{
+    void *chunks[FRAME_ARENA_MAX_CHUNKS];
+    size_t chunk_size;
+    uint32_t frame_size;
+    uint32_t num_chunks;
+    void *next_frame;
+    void *chunk_end;
+    void *free_list;
+} FrameArena;
+typedef struct
+{
+    char *filename;
+    int file_descriptor;
+    uint64_t file_length;
+    uint32_t num_pages;
+    uint32_t checkpoint_pages;
+    uint32_t page_size;
+    uint32_t leaf_node_max_cells;
+    uint32_t internal_node_max_keys;
+    uint32_t leaf_node_left_split_count;
+    uint32_t leaf_node_right_split_count;
+    bool compressed;
+    bool direct_io;
+    void *scratch;
+    PageMapEntry page_map[TABLE_MAX_PAGES];
+    PageMapEntry free_slots[PAGER_MAX_FREE_SLOTS];
+    uint32_t num_free_slots;
+    PageMapEntry pending_slots[PAGER_MAX_FREE_SLOTS];
+    uint32_t num_pending_slots;
+    void *pages[TABLE_MAX_PAGES];
+    bool dirty[TABLE_MAX_PAGES];
+    bool changed[TABLE_MAX_PAGES];
+    FrameArena arena;
+    pthread_mutex_t lock;
+    pthread_cond_t flusher_wakeup;
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stop;
+    uint32_t flush_rate;
+} Pager;
+typedef enum
+{
+    REPLICATION_HELLO,
+    REPLICATION_PAGE,
+    REPLICATION_COMMIT
+} ReplicationMessageType;
+typedef struct
+{
+    uint32_t type;
+    uint32_t page_num;
+    uint32_t page_size;
+    uint32_t num_pages;
+} ReplicationMessage;
+typedef struct
+{
+    bool is_primary;
+    char *socket_path;
+    int listen_fd;
+    int follower_fds[REPLICATION_MAX_FOLLOWERS];
+    uint32_t num_followers;
+    pthread_t acceptor;
+    pthread_t receiver;
+    bool stopping;
+    pthread_mutex_t lock;
+    int primary_fd;
+    uint32_t page_size;
+    void *staged[TABLE_MAX_PAGES];
+} Replication;
+struct Cursor
+{
+    Table *table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    bool end_of_table;
+    uint32_t depth;
+    uint32_t path[BTREE_MAX_DEPTH];
+    uint32_t path_index[BTREE_MAX_DEPTH];
+    uint64_t generation;
+    uint64_t resume_id;
+};
+struct Table
+{
+    uint32_t root_page_num;
+    Pager *pager;
+    Replication *replication;
+    bool read_only;
+    bool right_edge_valid;
+    Cursor right_edge;
+    uint64_t generation;
+};
+typedef enum
+{
+    NODE_INTERNAL,
+    NODE_LEAF
+} NodeType;
+
+static const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+static const uint32_t NODE_TYPE_OFFSET = 0;
+static const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+static const uint32_t NODE_MAX_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t NODE_MAX_KEY_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+static const uint8_t COMMON_NODE_HEADER_SIZE =
+    NODE_TYPE_SIZE + IS_ROOT_SIZE + NODE_MAX_KEY_SIZE;
+
+static const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
+    INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+static const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET =
+    INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+static const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                                  INTERNAL_NODE_NUM_KEYS_SIZE +
+                                                  INTERNAL_NODE_RIGHT_CHILD_SIZE +
+                                                  INTERNAL_NODE_RIGHT_COUNT_SIZE;
+
+static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CELL_SIZE =
+    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_COUNT_SIZE;
+
+static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+static const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                              LEAF_NODE_NUM_CELLS_SIZE +
+                                              LEAF_NODE_NEXT_LEAF_SIZE;
+
+static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_KEY_OFFSET = 0;
+static const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
+static const uint32_t LEAF_NODE_VALUE_OFFSET =
+    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+static const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+
+static __thread char open_error[128];
+static void set_open_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(open_error, sizeof(open_error), format, args);
+    va_end(args);
+}
+const char *db_open_error(void)
+{
+    return open_error;
+}
+
+static bool is_valid_page_size(uint32_t page_size)
+{
+    return page_size == 4096 || page_size == 8192 || page_size == 16384 || page_size == 65536;
+}
+static uint32_t *leaf_node_num_cells(void *node)
+{
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+static void *leaf_node_cell(void *node, uint32_t cell_num)
+{
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+}
+static uint32_t *leaf_node_key(void *node, uint32_t cell_num)
+{
+    return leaf_node_cell(node, cell_num);
+}
+static void *leaf_node_value(void *node, uint32_t cell_num)
+{
+    return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_OFFSET;
+}
+static void set_node_type(void *node, NodeType type)
+{
+    uint8_t value = type;
+    *((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
+}
+static void set_root_node(void *node, bool is_root)
+{
+    uint8_t value = is_root;
+    *((uint8_t *)(node + IS_ROOT_OFFSET)) = value;
+}
+static uint32_t *node_max_key(void *node)
+{
+    return node + NODE_MAX_KEY_OFFSET;
+}
+static uint32_t *leaf_node_next_leaf(void *node)
+{
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+static void *initialize_leaf_node(void *node)
+{
+    set_node_type(node, NODE_LEAF);
+    set_root_node(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0;
+}
+
+static uint32_t *internal_node_num_key(void *node)
+{
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+static uint32_t *internal_node_right_child(void *node)
+{
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+static uint32_t *internal_node_right_count(void *node)
+{
+    return node + INTERNAL_NODE_RIGHT_COUNT_OFFSET;
+}
+static void *initialize_internal_node(void *node)
+{
+    set_node_type(node, NODE_INTERNAL);
+    set_root_node(node, false);
+    *internal_node_num_key(node) = 0;
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
+    *internal_node_right_count(node) = 0;
+    *node_max_key(node) = 0;
+}
+
+static uint32_t *internal_node_cell(void *node, uint32_t cell_num)
+{
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+}
+
+static uint32_t *internal_node_child(void *node, uint32_t child_num)
+{
+    uint32_t num_keys = *internal_node_num_key(node);
+    if (child_num > num_keys)
+    {
+        printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+        exit(EXIT_FAILURE);
+    }
+    else if (child_num == num_keys)
+    {
+        uint32_t *right_child = internal_node_right_child(node);
+        if (*right_child == INVALID_PAGE_NUM)
+        {
+            printf("Tried to access right child of node, but was invalid page\n");
+            exit(EXIT_FAILURE);
+        }
+        return right_child;
+    }
+    else
+    {
+        uint32_t *child = internal_node_cell(node, child_num);
+        if (*child == INVALID_PAGE_NUM)
+        {
+            printf("Tried to access right child of node, but was invalid page\n");
+            exit(EXIT_FAILURE);
+        }
+        return child;
+    }
+}
+static uint32_t *internal_node_key(void *node, uint32_t key_num)
+{
+    return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+/*
+Number of rows in the subtree under child child_num. The right child's
+count lives in the header.
+*/
+static uint32_t *internal_node_count(void *node, uint32_t child_num)
+{
+    if (child_num == *internal_node_num_key(node))
+    {
+        return internal_node_right_count(node);
+    }
+    return (void *)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+}
+static NodeType get_node_type(void *node)
+{
+    uint32_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
+
+    return (NodeType)value;
+}
+
+
+static uint32_t lz_emit_length(uint8_t *dst, uint32_t pos, uint32_t dst_cap, uint32_t length)
+{
+    while (length >= 255)
+    {
+        if (pos >= dst_cap)
+        {
+            return UINT32_MAX;
+        }
+        dst[pos++] = 255;
+        length -= 255;
+    }
+    if (pos >= dst_cap)
+    {
+        return UINT32_MAX;
+    }
+    dst[pos++] = length;
+    return pos;
+}
+
+static uint32_t lz_emit_sequence(uint8_t *dst, uint32_t pos, uint32_t dst_cap, const uint8_t *literals,
+                                 uint32_t literal_length, uint32_t offset, uint32_t match_length)
+{
+    if (pos >= dst_cap)
+    {
+        return UINT32_MAX;
+    }
+    uint32_t token_pos = pos++;
+    uint8_t token = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if (literal_length >= 15 && (pos = lz_emit_length(dst, pos, dst_cap, literal_length - 15)) == UINT32_MAX)
+    {
+        return UINT32_MAX;
+    }
+    if (pos + literal_length > dst_cap)
+    {
+        return UINT32_MAX;
+    }
+    memcpy(dst + pos, literals, literal_length);
+    pos += literal_length;
+
+    if (match_length > 0)
+    {
+        uint32_t extra = match_length - LZ_MIN_MATCH;
+        token |= extra >= 15 ? 15 : extra;
+        if (pos + 2 > dst_cap)
+        {
+            return UINT32_MAX;
+        }
+        dst[pos++] = offset & 0xFF;
+        dst[pos++] = offset >> 8;
+        if (extra >= 15 && (pos = lz_emit_length(dst, pos, dst_cap, extra - 15)) == UINT32_MAX)
+        {
+            return UINT32_MAX;
+        }
+    }
+    dst[token_pos] = token;
+    return pos;
+}
+
+/*
+LZ77 block codec in the LZ4 style: each sequence is a token byte (literal length,
+match length - 4), the literals, a 2 byte back offset and extended lengths.
+Returns the compressed size, or 0 if it does not fit in dst_cap.
+*/
+static uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap)
+{
+    uint32_t hash_table[1 << LZ_HASH_BITS] = {0};
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+
+    while (ip + LZ_MIN_MATCH <= src_len)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + ip, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint32_t candidate = hash_table[hash];
+        hash_table[hash] = ip + 1;
+
+        uint32_t ref = candidate - 1;
+        if (candidate == 0 || ip - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+        uint32_t match_length = LZ_MIN_MATCH;
+        while (ip + match_length < src_len && src[ref + match_length] == src[ip + match_length])
+        {
+            match_length++;
+        }
+        pos = lz_emit_sequence(dst, pos, dst_cap, src + anchor, ip - anchor, ip - ref, match_length);
+        if (pos == UINT32_MAX)
+        {
+            return 0;
+        }
+        ip += match_length;
+        anchor = ip;
+    }
+    pos = lz_emit_sequence(dst, pos, dst_cap, src + anchor, src_len - anchor, 0, 0);
+    return pos == UINT32_MAX ? 0 : pos;
+}
+
+static bool lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len)
+{
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    while (ip < src_len)
+    {
+        uint8_t token = src[ip++];
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (ip >= src_len)
+                {
+                    return false;
+                }
+                byte = src[ip++];
+                literal_length += byte;
+            } while (byte == 255);
+        }
+        if (ip + literal_length > src_len || op + literal_length > dst_len)
+        {
+            return false;
+        }
+        memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == src_len)
+        {
+            break;
+        }
+
+        if (ip + 2 > src_len)
+        {
+            return false;
+        }
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        uint32_t match_length = (token & 0x0F) + LZ_MIN_MATCH;
+        if ((token & 0x0F) == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (ip >= src_len)
+                {
+                    return false;
+                }
+                byte = src[ip++];
+                match_length += byte;
+            } while (byte == 255);
+        }
+        if (offset == 0 || offset > op || op + match_length > dst_len)
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < match_length; i++, op++)
+        {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == dst_len;
+}
+
+typedef enum
+{
+    TRACE_PAGE_HIT,
+    TRACE_PAGE_MISS,
+    TRACE_PAGE_FLUSH,
+    TRACE_LEAF_SPLIT,
+    TRACE_INTERNAL_SPLIT,
+    TRACE_STATEMENT_BEGIN,
+    TRACE_STATEMENT_END
+} TraceEventType;
+static const char *TRACE_EVENT_NAMES[] = {"page_hit", "page_miss", "page_flush", "leaf_split",
+                                          "internal_split", "statement_begin", "statement_end"};
+typedef struct
+{
+    uint64_t time_ns;
+    TraceEventType type;
+    uint32_t arg1;
+    uint32_t arg2;
+} TraceEvent;
+typedef struct
+{
+    bool enabled;
+    uint64_t next;
+    uint32_t statement;
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+static TraceRing trace_ring;
+
+/*
+Every trace point fires the matching SDT probe (db:<name>, compiled in with
+-DDB_ENABLE_SDT) and, while .trace is on, appends to the in-memory ring.
+The flusher and replication threads trace too, so enabled is only read and
+written atomically.
+*/
+#define TRACE(type, name, arg1, arg2)                  \
+    do                                                 \
+    {                                                  \
+        DB_PROBE(name, arg1, arg2);                    \
+        if (__atomic_load_n(&trace_ring.enabled,       \
+                            __ATOMIC_RELAXED))         \
+        {                                              \
+            trace_record(type, arg1, arg2);            \
+        }                                              \
+    } while (0)
+
+static void trace_record(TraceEventType type, uint32_t arg1, uint32_t arg2)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t slot = __atomic_fetch_add(&trace_ring.next, 1, __ATOMIC_RELAXED);
+    TraceEvent *event = &trace_ring.events[slot % TRACE_RING_SIZE];
+    event->time_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    event->type = type;
+    event->arg1 = arg1;
+    event->arg2 = arg2;
+}
+
+static off_t pager_page_offset(Pager *pager, uint32_t page_num)
+{
+    return (off_t)(page_num + 1) * pager->page_size;
+}
+
+static void pager_read_compressed(Pager *pager, uint32_t page_num, void *page)
+{
+    PageMapEntry *entry = &pager->page_map[page_num];
+    void *buffer = entry->length == pager->page_size ? page : pager->scratch;
+    ssize_t bytes_read = pread(pager->file_descriptor, buffer, entry->length, entry->offset);
+    if (bytes_read != entry->length)
+    {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (buffer != page && !lz_decompress(buffer, entry->length, page, pager->page_size))
+    {
+        printf("Corrupt compressed page %d.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void frame_arena_init(FrameArena *arena)
+{
+    memset(arena, 0, sizeof(FrameArena));
+}
+
+static void *frame_arena_map_chunk(size_t size)
+{
+    void *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (chunk == MAP_FAILED)
+    {
+        chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+        {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(chunk, size, MADV_HUGEPAGE);
+#endif
+    }
+    return chunk;
+}
+
+/*
+Page frames are carved out of 2MB chunks (huge pages when the kernel gives
+them to us) and recycled through a free list threaded through the frames
+themselves, so a cache miss never calls the allocator.
+*/
+static void *frame_arena_alloc(FrameArena *arena)
+{
+    if (arena->free_list != NULL)
+    {
+        void *frame = arena->free_list;
+        arena->free_list = *(void **)frame;
+        return frame;
+    }
+    if (arena->next_frame == arena->chunk_end)
+    {
+        if (arena->num_chunks >= FRAME_ARENA_MAX_CHUNKS)
+        {
+            return NULL;
+        }
+        arena->chunk_size = arena->frame_size > FRAME_ARENA_CHUNK_SIZE ? arena->frame_size : FRAME_ARENA_CHUNK_SIZE;
+        void *chunk = frame_arena_map_chunk(arena->chunk_size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        arena->chunks[arena->num_chunks++] = chunk;
+        arena->next_frame = chunk;
+        arena->chunk_end = chunk + arena->chunk_size;
+    }
+    void *frame = arena->next_frame;
+    arena->next_frame += arena->frame_size;
+    return frame;
+}
+
+static void frame_arena_free(FrameArena *arena, void *frame)
+{
+    *(void **)frame = arena->free_list;
+    arena->free_list = frame;
+}
+
+static void frame_arena_release(FrameArena *arena)
+{
+    uint32_t frame_size = arena->frame_size;
+    for (uint32_t i = 0; i < arena->num_chunks; i++)
+    {
+        munmap(arena->chunks[i], arena->chunk_size);
+    }
+    frame_arena_init(arena);
+    arena->frame_size = frame_size;
+}
+
+static void *pager_alloc_frame(Pager *pager)
+{
+    void *frame = frame_arena_alloc(&pager->arena);
+    if (frame == NULL)
+    {
+        printf("Unable to allocate page.\n");
+        exit(EXIT_FAILURE);
+    }
+    return frame;
+}
+
+static uint32_t pager_file_pages(Pager *pager)
+{
+    if (pager->compressed)
+    {
+        return pager->num_pages;
+    }
+    return pager->file_length / pager->page_size - 1;
+}
+
+static void pager_mark_dirty(Pager *pager, uint32_t page_num)
+{
+    pager->dirty[page_num] = true;
+    pager->changed[page_num] = true;
+}
+
+static void pager_read_pages(Pager *pager, uint32_t page_num, uint32_t count)
+{
+    struct iovec iov[PAGER_MAX_IOVECS];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pager->pages[page_num + i] = pager_alloc_frame(pager);
+        iov[i].iov_base = pager->pages[page_num + i];
+        iov[i].iov_len = pager->page_size;
+    }
+    ssize_t bytes_read = preadv(pager->file_descriptor, iov, count, pager_page_offset(pager, page_num));
+    if (bytes_read != (ssize_t)count * pager->page_size)
+    {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void pager_prefetch(Pager *pager, uint32_t page_num)
+{
+    if (pager->compressed)
+    {
+        return;
+    }
+    uint32_t file_pages = pager_file_pages(pager);
+    uint32_t count = 0;
+    while (count < PAGER_READ_AHEAD && page_num + count < file_pages && page_num + count < pager->num_pages &&
+           pager->pages[page_num + count] == NULL)
+    {
+        count++;
+    }
+    if (count > 0)
+    {
+        pager_read_pages(pager, page_num, count);
+    }
+}
+
+static void *get_page(Pager *pager, uint32_t page_num)
+{
+    if (page_num >= TABLE_MAX_PAGES)
+    {
+        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
+               TABLE_MAX_PAGES);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pager->pages[page_num] != NULL)
+    {
+        TRACE(TRACE_PAGE_HIT, page_hit, page_num, 0);
+    }
+    else
+    {
+        TRACE(TRACE_PAGE_MISS, page_miss, page_num, 0);
+        if (page_num >= pager->num_pages)
+        {
+            pager->pages[page_num] = pager_alloc_frame(pager);
+            memset(pager->pages[page_num], 0, pager->page_size);
+            pager_mark_dirty(pager, page_num);
+        }
+        else if (pager->compressed && pager->page_map[page_num].length != 0)
+        {
+            pager->pages[page_num] = pager_alloc_frame(pager);
+            pager_read_compressed(pager, page_num, pager->pages[page_num]);
+        }
+        else if (!pager->compressed && page_num < pager_file_pages(pager))
+        {
+            pager_read_pages(pager, page_num, 1);
+        }
+        else
+        {
+            pager->pages[page_num] = pager_alloc_frame(pager);
+            memset(pager->pages[page_num], 0, pager->page_size);
+            pager_mark_dirty(pager, page_num);
+        }
+        if (page_num >= pager->num_pages)
+        {
+            pager->num_pages = page_num + 1;
+        }
+    }
+    return pager->pages[page_num];
+}
+static uint32_t get_node_max_key(void *node)
+{
+    return *node_max_key(node);
+}
+static void update_ancestor_max_key(Cursor *cursor, uint32_t key)
+{
+    Pager *pager = cursor->table->pager;
+    for (uint32_t level = cursor->depth; level > 0; level--)
+    {
+        uint32_t page_num = cursor->path[level - 1];
+        void *node = get_page(pager, page_num);
+        if (*node_max_key(node) >= key)
+        {
+            return;
+        }
+        *node_max_key(node) = key;
+        pager_mark_dirty(pager, page_num);
+    }
+}
+static void increment_ancestor_counts(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    for (uint32_t level = 0; level < cursor->depth; level++)
+    {
+        void *node = get_page(pager, cursor->path[level]);
+        *internal_node_count(node, cursor->path_index[level]) += 1;
+        pager_mark_dirty(pager, cursor->path[level]);
+    }
+}
+static uint32_t node_row_count(void *node)
+{
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        return *leaf_node_num_cells(node);
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= *internal_node_num_key(node); i++)
+    {
+        count += *internal_node_count(node, i);
+    }
+    return count;
+}
+static Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
+{
+    void *node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = num_cells;
+    while (one_past_max_index != min_index)
+    {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        uint32_t key_at_index = *leaf_node_key(node, index);
+        if (key == key_at_index)
+        {
+            cursor->cell_num = index;
+            return cursor;
+        }
+        if (key < key_at_index)
+        {
+            one_past_max_index = index;
+        }
+        else
+        {
+            min_index = index + 1;
+        }
+    }
+    cursor->cell_num = min_index;
+    return cursor;
+}
+
+static void print_constants(Pager *pager)
+{
+    printf("Constants:\n");
+    printf("PAGE_SIZE: %d\n", pager->page_size);
+    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", pager->page_size - LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", pager->leaf_node_max_cells);
+    printf("INTERNAL_NODE_MAX_KEYS: %d\n", pager->internal_node_max_keys);
+}
+
+static uint32_t internal_node_find_child(void *node, uint32_t key)
+{
+    uint32_t num_keys = *internal_node_num_key(node);
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+
+    while (max_index != min_index)
+    {
+        uint32_t index = (min_index + max_index) / 2;
+        uint32_t key_to_right = *internal_node_key(node, index);
+
+        if (key <= key_to_right)
+        {
+            max_index = index;
+        }
+        else
+        {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+/*
+Descends from the root, recording each internal page and the child index
+taken in the cursor's path so that splits can walk back up without parent
+pointers. The path to the rightmost leaf is remembered until the next split,
+so keys past the current maximum skip the descent.
+*/
+static Cursor *table_find(Table *table, uint32_t key)
+{
+    if (table->right_edge_valid)
+    {
+        void *leaf = get_page(table->pager, table->right_edge.page_num);
+        uint32_t num_cells = *leaf_node_num_cells(leaf);
+        if (num_cells > 0 && key > *node_max_key(leaf))
+        {
+            Cursor *cursor = malloc(sizeof(Cursor));
+            *cursor = table->right_edge;
+            cursor->cell_num = num_cells;
+            return cursor;
+        }
+    }
+    uint32_t page_num = table->root_page_num;
+    void *node = get_page(table->pager, page_num);
+    uint32_t depth = 0;
+    uint32_t path[BTREE_MAX_DEPTH];
+    uint32_t path_index[BTREE_MAX_DEPTH];
+    while (get_node_type(node) == NODE_INTERNAL)
+    {
+        if (depth >= BTREE_MAX_DEPTH)
+        {
+            printf("Tree is deeper than %d levels.\n", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t child_index = internal_node_find_child(node, key);
+        path[depth] = page_num;
+        path_index[depth] = child_index;
+        depth++;
+        page_num = *internal_node_child(node, child_index);
+        node = get_page(table->pager, page_num);
+    }
+    Cursor *cursor = leaf_node_find(table, page_num, key);
+    cursor->depth = depth;
+    memcpy(cursor->path, path, depth * sizeof(uint32_t));
+    memcpy(cursor->path_index, path_index, depth * sizeof(uint32_t));
+    if (*leaf_node_next_leaf(node) == 0)
+    {
+        table->right_edge = *cursor;
+        table->right_edge_valid = true;
+    }
+    return cursor;
+}
+static Cursor *table_start(Table *table)
+{
+    Cursor *cursor = table_find(table, 0);
+    void *node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    cursor->end_of_table = (num_cells == 0);
+    return cursor;
+}
+
+static void serialize_row(Row *source, void *destination)
+{
+    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
+    strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
+    strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+}
+static void deserialize_row(void *source, Row *destination)
+{
+    memcpy(&(destination->id), (source + ID_OFFSET), ID_SIZE);
+    memcpy(&(destination->username), (source + USERNAME_OFFSET), USERNAME_SIZE);
+    memcpy(&(destination->email), (source + EMAIL_OFFSET), EMAIL_SIZE);
+}
+
+/*
+The leaf layout depends on the page size, which comes from the file header,
+so every table carries its own copy.
+*/
+static void pager_set_page_size(Pager *pager, uint32_t page_size)
+{
+    pager->page_size = page_size;
+    pager->arena.frame_size = page_size;
+    pager->leaf_node_max_cells = (page_size - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_CELL_SIZE;
+    pager->leaf_node_right_split_count = (pager->leaf_node_max_cells + 1) / 2;
+    pager->leaf_node_left_split_count = (pager->leaf_node_max_cells + 1) - pager->leaf_node_right_split_count;
+    pager->internal_node_max_keys = (page_size - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+}
+static void pager_add_slot(PageMapEntry *slots, uint32_t *num_slots, uint64_t offset, uint32_t capacity)
+{
+    if (*num_slots < PAGER_MAX_FREE_SLOTS)
+    {
+        slots[*num_slots].offset = offset;
+        slots[*num_slots].length = 0;
+        slots[*num_slots].capacity = capacity;
+        (*num_slots)++;
+    }
+}
+static int page_map_entry_compare(const void *a, const void *b)
+{
+    const PageMapEntry *left = a;
+    const PageMapEntry *right = b;
+    return (left->offset > right->offset) - (left->offset < right->offset);
+}
+/*
+Rebuilds the free slot list of a compressed file from the gaps between the
+slots its header still uses, so space given up by pages that moved in an
+earlier session is not lost for good.
+*/
+static void pager_find_free_slots(Pager *pager)
+{
+    PageMapEntry live[TABLE_MAX_PAGES];
+    uint32_t num_live = 0;
+    for (uint32_t i = 0; i < pager->num_pages; i++)
+    {
+        if (pager->page_map[i].capacity != 0)
+        {
+            live[num_live++] = pager->page_map[i];
+        }
+    }
+    qsort(live, num_live, sizeof(PageMapEntry), page_map_entry_compare);
+    pager->file_length = pager->page_size;
+    for (uint32_t i = 0; i < num_live; i++)
+    {
+        if (live[i].offset > pager->file_length)
+        {
+            pager_add_slot(pager->free_slots, &pager->num_free_slots, pager->file_length,
+                           live[i].offset - pager->file_length);
+        }
+        if (live[i].offset + live[i].capacity > pager->file_length)
+        {
+            pager->file_length = live[i].offset + live[i].capacity;
+        }
+    }
+}
+static bool pager_read_header(Pager *pager)
+{
+    FileHeader header;
+    void *page;
+    if (posix_memalign(&page, PAGER_IO_ALIGN, DEFAULT_PAGE_SIZE) != 0)
+    {
+        printf("Unable to allocate page.\n");
+        exit(EXIT_FAILURE);
+    }
+    ssize_t bytes_read = pread(pager->file_descriptor, page, DEFAULT_PAGE_SIZE, 0);
+    memcpy(&header, page, sizeof(header));
+    free(page);
+    if (bytes_read != DEFAULT_PAGE_SIZE || memcmp(header.magic, PAGER_MAGIC, PAGER_MAGIC_SIZE) != 0)
+    {
+        set_open_error("Corrupt file.");
+        return false;
+    }
+    if (header.version < PAGER_MIN_VERSION || header.version > PAGER_VERSION)
+    {
+        set_open_error("Unsupported file version %d.", header.version);
+        return false;
+    }
+    if (!is_valid_page_size(header.page_size) || header.num_pages > TABLE_MAX_PAGES)
+    {
+        set_open_error("Corrupt file.");
+        return false;
+    }
+    pager_set_page_size(pager, header.page_size);
+    pager->compressed = header.flags & PAGER_FLAG_COMPRESSED;
+    pager->num_pages = header.num_pages;
+    pager->checkpoint_pages = header.num_pages;
+    memcpy(pager->page_map, header.page_map, sizeof(pager->page_map));
+    if (pager->compressed)
+    {
+        pager_find_free_slots(pager);
+    }
+    return true;
+}
+
+static void pager_write_header(Pager *pager)
+{
+    void *page = pager_alloc_frame(pager);
+    memset(page, 0, pager->page_size);
+    FileHeader *header = page;
+    memcpy(header->magic, PAGER_MAGIC, PAGER_MAGIC_SIZE);
+    header->version = PAGER_VERSION;
+    header->page_size = pager->page_size;
+    header->flags = pager->compressed ? PAGER_FLAG_COMPRESSED : 0;
+    header->num_pages = pager->num_pages;
+    memcpy(header->page_map, pager->page_map, sizeof(pager->page_map));
+    ssize_t bytes_written = pwrite(pager->file_descriptor, page, pager->page_size, 0);
+    frame_arena_free(&pager->arena, page);
+    if (bytes_written != pager->page_size)
+    {
+        printf("error in writing.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < pager->num_pending_slots; i++)
+    {
+        pager_add_slot(pager->free_slots, &pager->num_free_slots, pager->pending_slots[i].offset,
+                       pager->pending_slots[i].capacity);
+    }
+    pager->num_pending_slots = 0;
+    pager->checkpoint_pages = pager->num_pages;
+}
+
+static void pager_free(Pager *pager);
+static Pager *pager_open(const char *filename, const DbConfig *config)
+{
+
+    int flags = O_RDWR | O_CREAT;
+    if (config->direct_io)
+    {
+        flags |= O_DIRECT;
+    }
+    int fd = open(filename, flags, S_IWUSR | S_IRUSR);
+    if (fd == -1)
+    {
+        set_open_error("Unable to open the file.");
+        return NULL;
+    }
+    off_t file_length = lseek(fd, 0, SEEK_END);
+    Pager *pager = malloc(sizeof(Pager));
+    pager->filename = strdup(filename);
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->num_pages = 0;
+    pager->checkpoint_pages = 0;
+    pager->compressed = false;
+    pager->direct_io = config->direct_io;
+    pager->scratch = NULL;
+    frame_arena_init(&pager->arena);
+    pthread_mutex_init(&pager->lock, NULL);
+    pthread_cond_init(&pager->flusher_wakeup, NULL);
+    pager->flusher_running = false;
+    pager->flusher_stop = false;
+    pager->flush_rate = 0;
+    memset(pager->page_map, 0, sizeof(pager->page_map));
+    pager->num_free_slots = 0;
+    pager->num_pending_slots = 0;
+
+    if (file_length == 0)
+    {
+        if (config->page_size != 0 && !is_valid_page_size(config->page_size))
+        {
+            set_open_error("Page size must be 4096, 8192, 16384 or 65536.");
+            pager_free(pager);
+            return NULL;
+        }
+        pager_set_page_size(pager, config->page_size ? config->page_size : DEFAULT_PAGE_SIZE);
+        pager->compressed = config->compress;
+        pager->file_length = pager->page_size;
+    }
+    else if (!pager_read_header(pager))
+    {
+        pager_free(pager);
+        return NULL;
+    }
+    else if (!pager->compressed && file_length % pager->page_size != 0)
+    {
+        set_open_error("Corrupt file.");
+        pager_free(pager);
+        return NULL;
+    }
+    if (pager->compressed && pager->direct_io)
+    {
+        set_open_error("Direct I/O cannot be used with compressed files.");
+        pager_free(pager);
+        return NULL;
+    }
+    if (pager->compressed)
+    {
+        pager->scratch = malloc(pager->page_size);
+    }
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    {
+        pager->pages[i] = NULL;
+        pager->dirty[i] = false;
+        pager->changed[i] = false;
+    }
+    return pager;
+}
+
+/*
+Checks every node reachable from page_num before anything trusts it: a
+known node type, cell and key counts that fit the page, and child and
+next-leaf pointers that stay inside the file, reach each page once and, for
+leaves, land on another leaf. A table is at most TABLE_MAX_PAGES pages, so
+db_open walks all of it.
+*/
+static bool tree_is_valid(Pager *pager, uint32_t page_num, uint32_t depth, bool *visited)
+{
+    if (page_num >= pager->num_pages || visited[page_num] || depth > BTREE_MAX_DEPTH)
+    {
+        return false;
+    }
+    visited[page_num] = true;
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        uint32_t next_leaf = *leaf_node_next_leaf(node);
+        return *leaf_node_num_cells(node) <= pager->leaf_node_max_cells &&
+               (next_leaf == 0 ||
+                (next_leaf < pager->num_pages && get_node_type(get_page(pager, next_leaf)) == NODE_LEAF));
+    }
+    if (get_node_type(node) != NODE_INTERNAL || *internal_node_num_key(node) > pager->internal_node_max_keys)
+    {
+        return false;
+    }
+    uint32_t num_keys = *internal_node_num_key(node);
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        uint32_t child = i < num_keys ? *internal_node_cell(node, i) : *internal_node_right_child(node);
+        if (!tree_is_valid(pager, child, depth + 1, visited))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void pager_start_flusher(Pager *pager, uint32_t flush_rate);
+static void pager_stop_flusher(Pager *pager);
+static Replication *replication_connect(const char *socket_path);
+static void replication_free(Replication *replication);
+static bool replication_listen(Table *table, const char *socket_path);
+static bool replication_follow(Table *table);
+static bool pager_migrate_legacy(const char *filename);
+/*
+Returns NULL when the file or the replication socket cannot be opened, or
+the options are invalid; db_open_error() says why. The caller's config is
+left untouched.
+*/
+Table *db_open(const char *fileName, const DbConfig *config)
+{
+
+    DbConfig options = *config;
+    if (!pager_migrate_legacy(fileName))
+    {
+        return NULL;
+    }
+    Replication *replication = NULL;
+    if (options.follow_path != NULL)
+    {
+        replication = replication_connect(options.follow_path);
+        if (replication == NULL)
+        {
+            return NULL;
+        }
+        options.page_size = replication->page_size;
+    }
+    Pager *pager = pager_open(fileName, &options);
+    if (pager != NULL && replication != NULL && replication->page_size != pager->page_size)
+    {
+        set_open_error("Replica page size %d does not match the primary's %d.", pager->page_size,
+                       replication->page_size);
+        pager_free(pager);
+        pager = NULL;
+    }
+    bool visited[TABLE_MAX_PAGES] = {false};
+    if (pager != NULL && replication == NULL && pager->num_pages > 0 &&
+        !tree_is_valid(pager, 0, 0, visited))
+    {
+        set_open_error("Corrupt file.");
+        pager_free(pager);
+        pager = NULL;
+    }
+    if (pager == NULL)
+    {
+        if (replication != NULL)
+        {
+            close(replication->primary_fd);
+            replication_free(replication);
+        }
+        return NULL;
+    }
+    Table *table = malloc(sizeof(Table));
+    table->pager = pager;
+    table->root_page_num = 0;
+    table->replication = replication;
+    table->read_only = replication != NULL;
+    table->right_edge_valid = false;
+    table->generation = 0;
+    if (pager->num_pages == 0)
+    {
+        void *root_node = get_page(pager, 0);
+        initialize_leaf_node(root_node);
+        set_root_node(root_node, true);
+        pager_mark_dirty(pager, 0);
+    }
+    if (options.flush_rate > 0)
+    {
+        pager_start_flusher(pager, options.flush_rate);
+    }
+    bool replicating = true;
+    if (replication != NULL)
+    {
+        replicating = replication_follow(table);
+    }
+    else if (options.replicate_path != NULL)
+    {
+        replicating = replication_listen(table, options.replicate_path);
+    }
+    if (!replicating)
+    {
+        pager_stop_flusher(pager);
+        pager_free(pager);
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static uint32_t get_unused_pages(Pager *pager)
+{
+    return pager->num_pages;
+}
+
+static void create_new_root_node(Table *table, uint32_t right_child_page_num)
+{
+
+    void *root = get_page(table->pager, table->root_page_num);
+
+    void *right_child = get_page(table->pager, right_child_page_num);
+    uint32_t left_child_page_num = get_unused_pages(table->pager);
+    void *left_child = get_page(table->pager, left_child_page_num);
+    pager_mark_dirty(table->pager, table->root_page_num);
+    pager_mark_dirty(table->pager, left_child_page_num);
+    memcpy(left_child, root, table->pager->page_size);
+    set_root_node(left_child, false);
+
+    initialize_internal_node(root);
+    set_root_node(root, true);
+    *internal_node_num_key(root) = 1;
+
+    *internal_node_child(root, 0) = left_child_page_num;
+    uint32_t left_child_max_key = get_node_max_key(left_child);
+
+    *internal_node_key(root, 0) = left_child_max_key;
+    *internal_node_count(root, 0) = node_row_count(left_child);
+    *internal_node_right_child(root) = right_child_page_num;
+    *internal_node_count(root, 1) = node_row_count(right_child);
+    uint32_t right_child_max_key = get_node_max_key(right_child);
+    *node_max_key(root) = right_child_max_key > left_child_max_key ? right_child_max_key : left_child_max_key;
+}
+static void internal_node_fill(void *node, uint32_t *children, uint32_t *keys, uint32_t *row_counts, uint32_t count)
+{
+    *internal_node_num_key(node) = count - 1;
+    for (uint32_t i = 0; i < count - 1; i++)
+    {
+        *internal_node_cell(node, i) = children[i];
+        *internal_node_key(node, i) = keys[i];
+        *internal_node_count(node, i) = row_counts[i];
+    }
+    *internal_node_right_child(node) = children[count - 1];
+    *internal_node_count(node, count - 1) = row_counts[count - 1];
+    *node_max_key(node) = keys[count - 1];
+}
+static void internal_node_split_and_insert(Table *table, Cursor *cursor, uint32_t level, uint32_t left_max,
+                                           uint32_t right_page_num, bool append);
+/*
+The child at cursor->path_index[level] of the internal node at
+cursor->path[level] has split: it keeps the keys up to left_max and the
+rest moved to right_page_num, which goes in right after it. append is set
+when the split came from appending past the end of the rightmost leaf.
+*/
+static void internal_node_insert(Table *table, Cursor *cursor, uint32_t level, uint32_t left_max,
+                                 uint32_t right_page_num, bool append)
+{
+    uint32_t parent_page_num = cursor->path[level];
+    void *parent = get_page(table->pager, parent_page_num);
+    uint32_t index = cursor->path_index[level];
+    uint32_t original_num_keys = *internal_node_num_key(parent);
+    if (original_num_keys >= table->pager->internal_node_max_keys)
+    {
+        internal_node_split_and_insert(table, cursor, level, left_max, right_page_num, append);
+        return;
+    }
+    pager_mark_dirty(table->pager, parent_page_num);
+
+    uint32_t left_page_num = *internal_node_child(parent, index);
+    for (uint32_t i = original_num_keys; i > index; i--)
+    {
+        void *source = internal_node_cell(parent, i - 1);
+        void *destination = internal_node_cell(parent, i);
+        memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+    }
+    *internal_node_num_key(parent) = original_num_keys + 1;
+    *internal_node_cell(parent, index) = left_page_num;
+    *internal_node_key(parent, index) = left_max;
+    *internal_node_child(parent, index + 1) = right_page_num;
+    *internal_node_count(parent, index) = node_row_count(get_page(table->pager, left_page_num));
+    *internal_node_count(parent, index + 1) = node_row_count(get_page(table->pager, right_page_num));
+}
+
+/*
+Appending past the end of the rightmost leaf moves only the new key to the
+new leaf, so ascending inserts leave full leaves behind instead of half-empty
+ones. Any other split divides the cells evenly.
+*/
+static void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value)
+{
+
+    Pager *pager = cursor->table->pager;
+    void *old_node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t new_page_num = get_unused_pages(cursor->table->pager);
+    void *new_node = get_page(cursor->table->pager, new_page_num);
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+    pager_mark_dirty(cursor->table->pager, new_page_num);
+    cursor->table->right_edge_valid = false;
+    TRACE(TRACE_LEAF_SPLIT, leaf_split, cursor->page_num, new_page_num);
+    initialize_leaf_node(new_node);
+    bool append = *leaf_node_next_leaf(old_node) == 0 && cursor->cell_num == pager->leaf_node_max_cells;
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    if (append)
+    {
+        serialize_row(value, leaf_node_value(new_node, 0));
+        *leaf_node_key(new_node, 0) = key;
+        *leaf_node_num_cells(new_node) = 1;
+        *node_max_key(new_node) = key;
+    }
+    for (int32_t i = pager->leaf_node_max_cells; !append && i >= 0; i--)
+    {
+        void *destination_node;
+        if (i >= pager->leaf_node_left_split_count)
+        {
+            destination_node = new_node;
+        }
+        else
+        {
+            destination_node = old_node;
+        }
+        uint32_t index_within_node = i % pager->leaf_node_left_split_count;
+        void *destination = leaf_node_cell(destination_node, index_within_node);
+        if (i == cursor->cell_num)
+        {
+            serialize_row(value, leaf_node_value(destination_node, index_within_node));
+            *leaf_node_key(destination_node, index_within_node) = key;
+        }
+        else if (i > cursor->cell_num)
+        {
+            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+        }
+        else
+        {
+            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+        }
+    }
+
+    if (!append)
+    {
+        *(leaf_node_num_cells(old_node)) = pager->leaf_node_left_split_count;
+        *(leaf_node_num_cells(new_node)) = pager->leaf_node_right_split_count;
+        *node_max_key(old_node) = *leaf_node_key(old_node, pager->leaf_node_left_split_count - 1);
+        *node_max_key(new_node) = *leaf_node_key(new_node, pager->leaf_node_right_split_count - 1);
+    }
+    if (cursor->depth == 0)
+    {
+        return create_new_root_node(cursor->table, new_page_num);
+    }
+    else
+    {
+        internal_node_insert(cursor->table, cursor, cursor->depth - 1, *node_max_key(old_node), new_page_num,
+                             append);
+        return;
+    }
+}
+
+static void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value)
+{
+    void *node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (cursor->cell_num == num_cells)
+    {
+        update_ancestor_max_key(cursor, key);
+    }
+    increment_ancestor_counts(cursor);
+
+    if (num_cells >= cursor->table->pager->leaf_node_max_cells)
+    {
+        leaf_node_split_and_insert(cursor, key, value);
+        return;
+    }
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+
+    if (cursor->cell_num < num_cells)
+    {
+
+        for (uint32_t i = num_cells; i > cursor->cell_num; i--)
+        {
+            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+        }
+    }
+    *(leaf_node_num_cells(node)) += 1;
+    *(leaf_node_key(node, cursor->cell_num)) = key;
+    if (cursor->cell_num == num_cells)
+    {
+        *node_max_key(node) = key;
+    }
+    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+}
+/*
+Lays the full node's children out with the new right sibling in place,
+keeps the lower half in the old page and moves the upper half to a new
+page, then pushes the new page into the next level up the path. When the
+split started with an append to the rightmost leaf only the new child moves,
+as with leaves. Moved children are not touched.
+*/
+static void internal_node_split_and_insert(Table *table, Cursor *cursor, uint32_t level, uint32_t left_max,
+                                           uint32_t right_page_num, bool append)
+{
+    uint32_t old_page_num = cursor->path[level];
+    void *old_node = get_page(table->pager, old_page_num);
+    uint32_t index = cursor->path_index[level];
+    uint32_t num_keys = *internal_node_num_key(old_node);
+
+    uint32_t max_children = table->pager->internal_node_max_keys + 2;
+    uint32_t *children = malloc(3 * max_children * sizeof(uint32_t));
+    uint32_t *keys = children + max_children;
+    uint32_t *row_counts = keys + max_children;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        uint32_t child_max = i < num_keys ? *internal_node_key(old_node, i) : *node_max_key(old_node);
+        children[count] = *internal_node_child(old_node, i);
+        row_counts[count] = *internal_node_count(old_node, i);
+        if (i == index)
+        {
+            row_counts[count] = node_row_count(get_page(table->pager, children[count]));
+            keys[count++] = left_max;
+            children[count] = right_page_num;
+            row_counts[count] = node_row_count(get_page(table->pager, right_page_num));
+        }
+        keys[count++] = child_max;
+    }
+
+    uint32_t new_page_num = get_unused_pages(table->pager);
+    void *new_node = get_page(table->pager, new_page_num);
+    pager_mark_dirty(table->pager, old_page_num);
+    pager_mark_dirty(table->pager, new_page_num);
+    TRACE(TRACE_INTERNAL_SPLIT, internal_split, old_page_num, new_page_num);
+    initialize_internal_node(new_node);
+
+    uint32_t left_count = append ? count - 1 : count / 2;
+    internal_node_fill(old_node, children, keys, row_counts, left_count);
+    internal_node_fill(new_node, children + left_count, keys + left_count, row_counts + left_count,
+                       count - left_count);
+
+    uint32_t new_left_max = keys[left_count - 1];
+    free(children);
+    if (level == 0)
+    {
+        create_new_root_node(table, new_page_num);
+    }
+    else
+    {
+        internal_node_insert(table, cursor, level - 1, new_left_max, new_page_num, append);
+    }
+}
+/*
+Gives a compressed page that outgrew its slot the smallest free slot that
+fits, splitting off what it does not need, or a new slot at the end of the
+file. A slot a page moves out of is only pending until the next header
+write: the header on disk may still point at it.
+*/
+static void pager_alloc_slot(Pager *pager, PageMapEntry *entry, uint32_t capacity)
+{
+    uint32_t best = pager->num_free_slots;
+    for (uint32_t i = 0; i < pager->num_free_slots; i++)
+    {
+        if (pager->free_slots[i].capacity >= capacity &&
+            (best == pager->num_free_slots || pager->free_slots[i].capacity < pager->free_slots[best].capacity))
+        {
+            best = i;
+        }
+    }
+    if (best == pager->num_free_slots)
+    {
+        entry->offset = pager->file_length;
+        entry->capacity = capacity;
+        pager->file_length += capacity;
+        return;
+    }
+    PageMapEntry *slot = &pager->free_slots[best];
+    entry->offset = slot->offset;
+    entry->capacity = capacity;
+    slot->offset += capacity;
+    slot->capacity -= capacity;
+    if (slot->capacity == 0)
+    {
+        *slot = pager->free_slots[--pager->num_free_slots];
+    }
+}
+static void pager_flush_compressed(Pager *pager, uint32_t page_num)
+{
+    TRACE(TRACE_PAGE_FLUSH, page_flush, page_num, 1);
+    PageMapEntry *entry = &pager->page_map[page_num];
+    void *data = pager->scratch;
+    uint32_t length = lz_compress(pager->pages[page_num], pager->page_size, pager->scratch, pager->page_size - 1);
+    if (length == 0)
+    {
+        data = pager->pages[page_num];
+        length = pager->page_size;
+    }
+    if (length > entry->capacity)
+    {
+        if (entry->capacity != 0)
+        {
+            pager_add_slot(pager->pending_slots, &pager->num_pending_slots, entry->offset, entry->capacity);
+        }
+        pager_alloc_slot(pager, entry, (length + PAGER_SLOT_ALIGN - 1) / PAGER_SLOT_ALIGN * PAGER_SLOT_ALIGN);
+    }
+    entry->length = length;
+
+    ssize_t bytes_written = pwrite(pager->file_descriptor, data, length, entry->offset);
+    if (bytes_written != length)
+    {
+        printf("error in writing.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void pager_flush_run(Pager *pager, uint32_t page_num, uint32_t count)
+{
+    TRACE(TRACE_PAGE_FLUSH, page_flush, page_num, count);
+    struct iovec iov[PAGER_MAX_IOVECS];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        iov[i].iov_base = pager->pages[page_num + i];
+        iov[i].iov_len = pager->page_size;
+    }
+    off_t offset = pager_page_offset(pager, page_num);
+    ssize_t bytes_written = pwritev(pager->file_descriptor, iov, count, offset);
+    if (bytes_written != (ssize_t)count * pager->page_size)
+    {
+        printf("error in writing.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (offset + bytes_written > pager->file_length)
+    {
+        pager->file_length = offset + bytes_written;
+    }
+}
+
+static void *pager_flush(Pager *pager, uint32_t page_num)
+{
+    if (pager->pages[page_num] == NULL)
+    {
+        printf("tried to flush empty page");
+        exit(EXIT_FAILURE);
+    }
+    if (pager->compressed)
+    {
+        pager_flush_compressed(pager, page_num);
+    }
+    else
+    {
+        pager_flush_run(pager, page_num, 1);
+    }
+    pager->dirty[page_num] = false;
+    return NULL;
+}
+
+static uint32_t pager_flush_dirty(Pager *pager, uint32_t first_page, uint32_t max_pages)
+{
+    uint32_t page_num = first_page;
+    uint32_t flushed = 0;
+    while (page_num < pager->num_pages && flushed < max_pages)
+    {
+        if (!pager->dirty[page_num])
+        {
+            page_num++;
+            continue;
+        }
+        if (pager->compressed)
+        {
+            pager_flush(pager, page_num);
+            page_num++;
+            flushed++;
+            continue;
+        }
+        uint32_t count = 1;
+        while (count < PAGER_MAX_IOVECS && flushed + count < max_pages &&
+               page_num + count < pager->num_pages && pager->dirty[page_num + count])
+        {
+            count++;
+        }
+        pager_flush_run(pager, page_num, count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            pager->dirty[page_num + i] = false;
+        }
+        page_num += count;
+        flushed += count;
+    }
+    return flushed;
+}
+
+static void pager_flush_all(Pager *pager)
+{
+    pager_flush_dirty(pager, 0, UINT32_MAX);
+}
+
+static void pager_lock(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+}
+
+static void pager_unlock(Pager *pager)
+{
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+Background writer: every PAGER_FLUSH_INTERVAL_MS it takes the pager lock and
+writes back up to flush_rate / 10 dirty pages, so dirty data trickles out
+between statements instead of piling up for db_close(). It only writes
+pages allocated since the last header write. Nothing on disk points at
+those yet, so a crash leaves the file exactly as it was at that header;
+pages the header's tree already uses wait for the next checkpoint.
+*/
+static void *pager_flusher_main(void *arg)
+{
+    Pager *pager = arg;
+    uint32_t batch = pager->flush_rate * PAGER_FLUSH_INTERVAL_MS / 1000;
+    if (batch == 0)
+    {
+        batch = 1;
+    }
+    pager_lock(pager);
+    while (!pager->flusher_stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PAGER_FLUSH_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&pager->flusher_wakeup, &pager->lock, &deadline);
+        if (!pager->flusher_stop)
+        {
+            pager_flush_dirty(pager, pager->checkpoint_pages, batch);
+        }
+    }
+    pager_unlock(pager);
+    return NULL;
+}
+
+static void pager_start_flusher(Pager *pager, uint32_t flush_rate)
+{
+    pager->flush_rate = flush_rate;
+    pager->flusher_stop = false;
+    if (pthread_create(&pager->flusher, NULL, pager_flusher_main, pager) != 0)
+    {
+        printf("Unable to start the flusher thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->flusher_running = true;
+}
+
+static void pager_stop_flusher(Pager *pager)
+{
+    if (!pager->flusher_running)
+    {
+        return;
+    }
+    pager_lock(pager);
+    pager->flusher_stop = true;
+    pthread_cond_signal(&pager->flusher_wakeup);
+    pager_unlock(pager);
+    pthread_join(pager->flusher, NULL);
+    pager->flusher_running = false;
+}
+
+/*
+Writes every dirty page and the header, then fsyncs. Runs under the pager
+lock, so it is ordered after any write-back the flusher has in flight.
+*/
+static void pager_checkpoint(Pager *pager)
+{
+    pager_lock(pager);
+    pager_flush_all(pager);
+    pager_write_header(pager);
+    if (fsync(pager->file_descriptor) == -1)
+    {
+        printf("error in syncing.\n");
+        exit(EXIT_FAILURE);
+    }
+    pager_unlock(pager);
+}
+static bool write_full(int fd, const void *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t bytes_written = send(fd, buffer, length, MSG_NOSIGNAL);
+        if (bytes_written <= 0)
+        {
+            return false;
+        }
+        buffer += bytes_written;
+        length -= bytes_written;
+    }
+    return true;
+}
+
+static bool read_full(int fd, void *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t bytes_read = read(fd, buffer, length);
+        if (bytes_read <= 0)
+        {
+            return false;
+        }
+        buffer += bytes_read;
+        length -= bytes_read;
+    }
+    return true;
+}
+
+static bool replication_send_page(int fd, Pager *pager, uint32_t page_num)
+{
+    ReplicationMessage message = {REPLICATION_PAGE, page_num, pager->page_size, pager->num_pages};
+    return write_full(fd, &message, sizeof(message)) &&
+           write_full(fd, get_page(pager, page_num), pager->page_size);
+}
+
+static bool replication_send_commit(int fd, Pager *pager)
+{
+    ReplicationMessage message = {REPLICATION_COMMIT, 0, pager->page_size, pager->num_pages};
+    return write_full(fd, &message, sizeof(message));
+}
+
+static void replication_drop_follower(Replication *replication, uint32_t index)
+{
+    close(replication->follower_fds[index]);
+    replication->follower_fds[index] = replication->follower_fds[--replication->num_followers];
+}
+
+/*
+New followers get a hello and a full snapshot of the table under the pager
+lock, so the copy they start from sits between two statements.
+*/
+static void *replication_acceptor_main(void *arg)
+{
+    Table *table = arg;
+    Replication *replication = table->replication;
+    while (true)
+    {
+        int fd = accept(replication->listen_fd, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return NULL;
+        }
+        struct timeval timeout = {REPLICATION_SEND_TIMEOUT_MS / 1000, REPLICATION_SEND_TIMEOUT_MS % 1000 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        pthread_mutex_lock(&replication->lock);
+        Pager *pager = table->pager;
+        pager_lock(pager);
+        ReplicationMessage hello = {REPLICATION_HELLO, 0, pager->page_size, pager->num_pages};
+        bool sent = replication->num_followers < REPLICATION_MAX_FOLLOWERS &&
+                    write_full(fd, &hello, sizeof(hello));
+        for (uint32_t i = 0; sent && i < pager->num_pages; i++)
+        {
+            sent = replication_send_page(fd, pager, i);
+        }
+        sent = sent && replication_send_commit(fd, pager);
+        pager_unlock(pager);
+        if (sent)
+        {
+            replication->follower_fds[replication->num_followers++] = fd;
+        }
+        else
+        {
+            close(fd);
+        }
+        pthread_mutex_unlock(&replication->lock);
+    }
+}
+
+static bool replication_listen(Table *table, const char *socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        set_open_error("Socket path is too long.");
+        return false;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    Replication *replication = calloc(1, sizeof(Replication));
+    replication->is_primary = true;
+    replication->socket_path = strdup(socket_path);
+    replication->primary_fd = -1;
+    pthread_mutex_init(&replication->lock, NULL);
+    replication->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (replication->listen_fd == -1 ||
+        bind(replication->listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(replication->listen_fd, REPLICATION_MAX_FOLLOWERS) == -1)
+    {
+        set_open_error("Unable to listen on %s.", socket_path);
+        if (replication->listen_fd != -1)
+        {
+            close(replication->listen_fd);
+        }
+        free(replication->socket_path);
+        replication_free(replication);
+        return false;
+    }
+    table->replication = replication;
+    if (pthread_create(&replication->acceptor, NULL, replication_acceptor_main, table) != 0)
+    {
+        printf("Unable to start the replication thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+/*
+Ships every page changed since the last call, followed by a commit marker,
+to each follower. Called once a statement has finished.
+*/
+static void replication_publish(Table *table)
+{
+    Replication *replication = table->replication;
+    if (replication == NULL || !replication->is_primary)
+    {
+        return;
+    }
+    pthread_mutex_lock(&replication->lock);
+    Pager *pager = table->pager;
+    pager_lock(pager);
+    bool any_changed = false;
+    for (uint32_t page_num = 0; page_num < pager->num_pages; page_num++)
+    {
+        if (!pager->changed[page_num])
+        {
+            continue;
+        }
+        any_changed = true;
+        for (uint32_t i = 0; i < replication->num_followers;)
+        {
+            if (replication_send_page(replication->follower_fds[i], pager, page_num))
+            {
+                i++;
+            }
+            else
+            {
+                replication_drop_follower(replication, i);
+            }
+        }
+        pager->changed[page_num] = false;
+    }
+    for (uint32_t i = 0; any_changed && i < replication->num_followers;)
+    {
+        if (replication_send_commit(replication->follower_fds[i], pager))
+        {
+            i++;
+        }
+        else
+        {
+            replication_drop_follower(replication, i);
+        }
+    }
+    pager_unlock(pager);
+    pthread_mutex_unlock(&replication->lock);
+}
+
+static Replication *replication_connect(const char *socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        set_open_error("Unable to connect to %s.", socket_path);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    ReplicationMessage hello;
+    if (!read_full(fd, &hello, sizeof(hello)) || hello.type != REPLICATION_HELLO ||
+        !is_valid_page_size(hello.page_size))
+    {
+        set_open_error("Bad handshake from primary.");
+        close(fd);
+        return NULL;
+    }
+    Replication *replication = calloc(1, sizeof(Replication));
+    replication->is_primary = false;
+    replication->listen_fd = -1;
+    replication->primary_fd = fd;
+    replication->page_size = hello.page_size;
+    pthread_mutex_init(&replication->lock, NULL);
+    return replication;
+}
+
+/*
+Reads messages from the primary until a commit marker arrives. Pages are
+staged and only copied into the pager on commit, so readers never see half
+a statement.
+*/
+static bool replication_receive(Table *table)
+{
+    Replication *replication = table->replication;
+    uint32_t num_pages;
+    while (true)
+    {
+        ReplicationMessage message;
+        if (!read_full(replication->primary_fd, &message, sizeof(message)) ||
+            message.page_num >= TABLE_MAX_PAGES || message.num_pages > TABLE_MAX_PAGES)
+        {
+            return false;
+        }
+        if (message.type == REPLICATION_PAGE)
+        {
+            if (replication->staged[message.page_num] == NULL)
+            {
+                replication->staged[message.page_num] = malloc(replication->page_size);
+            }
+            if (!read_full(replication->primary_fd, replication->staged[message.page_num], replication->page_size))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (message.type == REPLICATION_COMMIT)
+        {
+            num_pages = message.num_pages;
+            break;
+        }
+    }
+
+    Pager *pager = table->pager;
+    pager_lock(pager);
+    for (uint32_t page_num = 0; page_num < TABLE_MAX_PAGES; page_num++)
+    {
+        if (replication->staged[page_num] == NULL)
+        {
+            continue;
+        }
+        memcpy(get_page(pager, page_num), replication->staged[page_num], pager->page_size);
+        pager_mark_dirty(pager, page_num);
+        free(replication->staged[page_num]);
+        replication->staged[page_num] = NULL;
+    }
+    pager->num_pages = num_pages;
+    table->right_edge_valid = false;
+    table->generation++;
+    pager_unlock(pager);
+    return true;
+}
+
+static void *replication_receiver_main(void *arg)
+{
+    Table *table = arg;
+    while (replication_receive(table))
+    {
+    }
+    if (!table->replication->stopping)
+    {
+        printf("Lost connection to primary.\n");
+    }
+    return NULL;
+}
+
+/*
+Applies the primary's snapshot before returning, so the replica opens with a
+complete copy, then keeps applying batches on a background thread.
+*/
+static bool replication_follow(Table *table)
+{
+    if (!replication_receive(table))
+    {
+        set_open_error("Lost connection to primary.");
+        close(table->replication->primary_fd);
+        replication_free(table->replication);
+        table->replication = NULL;
+        return false;
+    }
+    if (pthread_create(&table->replication->receiver, NULL, replication_receiver_main, table) != 0)
+    {
+        printf("Unable to start the replication thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+static void replication_stop(Table *table)
+{
+    Replication *replication = table->replication;
+    if (replication == NULL)
+    {
+        return;
+    }
+    if (replication->is_primary)
+    {
+        shutdown(replication->listen_fd, SHUT_RDWR);
+        close(replication->listen_fd);
+        pthread_join(replication->acceptor, NULL);
+        for (uint32_t i = 0; i < replication->num_followers; i++)
+        {
+            close(replication->follower_fds[i]);
+        }
+        unlink(replication->socket_path);
+        free(replication->socket_path);
+    }
+    else
+    {
+        replication->stopping = true;
+        shutdown(replication->primary_fd, SHUT_RDWR);
+        pthread_join(replication->receiver, NULL);
+        close(replication->primary_fd);
+    }
+    replication_free(replication);
+    table->replication = NULL;
+}
+
+static void replication_free(Replication *replication)
+{
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    {
+        free(replication->staged[i]);
+    }
+    pthread_mutex_destroy(&replication->lock);
+    free(replication);
+}
+
+static void pager_free(Pager *pager)
+{
+    int result = close(pager->file_descriptor);
+    if (result == -1)
+    {
+        printf("error in clsoing.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    {
+        pager->pages[i] = NULL;
+    }
+    frame_arena_release(&pager->arena);
+    pthread_mutex_destroy(&pager->lock);
+    pthread_cond_destroy(&pager->flusher_wakeup);
+    free(pager->scratch);
+    free(pager->filename);
+    free(pager);
+}
+void db_close(Table *table)
+{
+    replication_stop(table);
+    Pager *pager = table->pager;
+    pager_stop_flusher(pager);
+    pager_flush_all(pager);
+    pager_write_header(pager);
+    pager_free(pager);
+    free(table);
+}
+static void indent(uint32_t level)
+{
+    for (uint32_t i = 0; i < level; i++)
+    {
+        printf("  ");
+    }
+}
+static void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
+{
+    void *node = get_page(pager, page_num);
+    uint32_t num_keys, child;
+
+    switch (get_node_type(node))
+    {
+    case NODE_LEAF:
+        num_keys = *leaf_node_num_cells(node);
+        indent(indentation_level);
+        printf("- leaf (size %d)\n", num_keys);
+
+        for (uint32_t i = 0; i < num_keys; i++)
+        {
+            indent(indentation_level + 1);
+            printf("- %d\n", *leaf_node_key(node, i));
+        }
+        break;
+
+    case NODE_INTERNAL:
+        num_keys = *internal_node_num_key(node);
+        indent(indentation_level);
+        printf("- internal (size %d)\n", num_keys);
+
+        if (num_keys > 0)
+        {
+            for (uint32_t i = 0; i < num_keys; i++)
+            {
+                child = *internal_node_child(node, i);
+                print_tree(pager, child, indentation_level + 1);
+
+                indent(indentation_level + 1);
+                printf("- key %d\n", *internal_node_key(node, i));
+            }
+            child = *internal_node_right_child(node);
+            print_tree(pager, child, indentation_level + 1);
+        }
+        break;
+    }
+}
+
+static void *cursor_value(Cursor *cursor)
+{
+    uint32_t page_num = cursor->page_num;
+    void *page = get_page(cursor->table->pager, page_num);
+    return leaf_node_value(page, cursor->cell_num);
+}
+static void cursor_advance(Cursor *cursor)
+{
+    uint32_t page_num = cursor->page_num;
+    void *node = get_page(cursor->table->pager, page_num);
+    cursor->cell_num += 1;
+
+    if (cursor->cell_num >= (*leaf_node_num_cells(node)))
+    {
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0)
+        {
+            cursor->end_of_table = true;
+        }
+        else
+        {
+            pager_prefetch(cursor->table->pager, next_page_num);
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+        }
+    }
+}
+static uint32_t table_count(Table *table);
+/*
+Builds the nodes of one tree level over children[0..count), spreading the
+children evenly over as few nodes as fit. The level that ends up with a
+single node is written to the root page.
+*/
+static uint32_t bulk_load_level(Pager *pager, uint32_t *children, uint32_t *keys, uint32_t *row_counts,
+                                uint32_t count, uint32_t *next_page_num)
+{
+    uint32_t fan_out = pager->internal_node_max_keys + 1;
+    uint32_t num_nodes = (count + fan_out - 1) / fan_out;
+    uint32_t consumed = 0;
+    for (uint32_t i = 0; i < num_nodes; i++)
+    {
+        uint32_t node_count = count / num_nodes + (i < count % num_nodes ? 1 : 0);
+        uint32_t page_num = num_nodes == 1 ? 0 : (*next_page_num)++;
+        void *node = get_page(pager, page_num);
+        initialize_internal_node(node);
+        internal_node_fill(node, children + consumed, keys + consumed, row_counts + consumed, node_count);
+        set_root_node(node, num_nodes == 1);
+        consumed += node_count;
+        children[i] = page_num;
+        keys[i] = keys[consumed - 1];
+        row_counts[i] = node_row_count(node);
+    }
+    return num_nodes;
+}
+static uint32_t bulk_load_pages(Pager *pager, uint32_t num_leaves)
+{
+    uint32_t num_pages = num_leaves == 1 ? 1 : num_leaves + 1;
+    for (uint32_t level = num_leaves; level > 1;)
+    {
+        level = (level + pager->internal_node_max_keys) / (pager->internal_node_max_keys + 1);
+        num_pages += level > 1 ? level : 0;
+    }
+    return num_pages;
+}
+/*
+Fills an empty pager with cells[0..num_rows), which are in key order, spread
+evenly over num_leaves leaves on consecutive pages, with the internal levels
+after them and the root on page 0.
+*/
+static void bulk_load(Pager *pager, void **cells, uint32_t num_rows, uint32_t num_leaves)
+{
+    uint32_t children[TABLE_MAX_PAGES];
+    uint32_t keys[TABLE_MAX_PAGES];
+    uint32_t row_counts[TABLE_MAX_PAGES];
+    uint32_t next_page_num = num_leaves == 1 ? 0 : 1;
+    uint32_t row = 0;
+    for (uint32_t i = 0; i < num_leaves; i++)
+    {
+        uint32_t leaf_rows = num_rows / num_leaves + (i < num_rows % num_leaves ? 1 : 0);
+        uint32_t page_num = next_page_num++;
+        void *leaf = get_page(pager, page_num);
+        initialize_leaf_node(leaf);
+        set_root_node(leaf, num_leaves == 1);
+        *leaf_node_next_leaf(leaf) = i + 1 < num_leaves ? page_num + 1 : 0;
+        for (uint32_t cell_num = 0; cell_num < leaf_rows; cell_num++)
+        {
+            memcpy(leaf_node_cell(leaf, cell_num), cells[row++], LEAF_NODE_CELL_SIZE);
+            *node_max_key(leaf) = *leaf_node_key(leaf, cell_num);
+        }
+        *leaf_node_num_cells(leaf) = leaf_rows;
+        children[i] = page_num;
+        keys[i] = *node_max_key(leaf);
+        row_counts[i] = leaf_rows;
+    }
+
+    uint32_t count = num_leaves;
+    while (count > 1)
+    {
+        count = bulk_load_level(pager, children, keys, row_counts, count, &next_page_num);
+    }
+}
+
+/*
+Rewrites the table into <file>.vacuum with the leaves filled to fill_percent,
+then renames it over the database file and keeps using the new pager, whose
+cache already holds the rebuilt tree. Sets needed_pages to the size of the
+rebuilt table, or to the size it would need when that exceeds
+TABLE_MAX_PAGES and the table is left as it was.
+*/
+static DbResult table_vacuum(Table *table, uint32_t fill_percent, uint32_t *needed_pages)
+{
+    Pager *old_pager = table->pager;
+    uint32_t flush_rate = old_pager->flusher_running ? old_pager->flush_rate : 0;
+    pager_stop_flusher(old_pager);
+
+    uint32_t num_rows = table_count(table);
+    uint32_t rows_per_leaf = old_pager->leaf_node_max_cells * fill_percent / 100;
+    if (rows_per_leaf == 0)
+    {
+        rows_per_leaf = 1;
+    }
+    uint32_t num_leaves = num_rows == 0 ? 1 : (num_rows + rows_per_leaf - 1) / rows_per_leaf;
+    uint32_t num_pages = bulk_load_pages(old_pager, num_leaves);
+    if (num_pages > TABLE_MAX_PAGES)
+    {
+        *needed_pages = num_pages;
+        if (flush_rate > 0)
+        {
+            pager_start_flusher(old_pager, flush_rate);
+        }
+        return DB_TABLE_FULL;
+    }
+
+    char *vacuum_filename = malloc(strlen(old_pager->filename) + strlen(".vacuum") + 1);
+    sprintf(vacuum_filename, "%s.vacuum", old_pager->filename);
+    unlink(vacuum_filename);
+    DbConfig config = {0};
+    config.compress = old_pager->compressed;
+    config.direct_io = old_pager->direct_io;
+    config.page_size = old_pager->page_size;
+    Pager *pager = pager_open(vacuum_filename, &config);
+    if (pager == NULL)
+    {
+        printf("%s\n", db_open_error());
+        exit(EXIT_FAILURE);
+    }
+
+    void **cells = malloc(num_rows * sizeof(void *));
+    Cursor *cursor = table_start(table);
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        cells[row] = leaf_node_cell(get_page(old_pager, cursor->page_num), cursor->cell_num);
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    bulk_load(pager, cells, num_rows, num_leaves);
+    free(cells);
+
+    pager_checkpoint(pager);
+    if (rename(vacuum_filename, old_pager->filename) == -1)
+    {
+        printf("Unable to replace the database file.\n");
+        exit(EXIT_FAILURE);
+    }
+    free(pager->filename);
+    pager->filename = strdup(old_pager->filename);
+    free(vacuum_filename);
+    pager_free(old_pager);
+    table->pager = pager;
+    table->right_edge_valid = false;
+    table->generation++;
+    if (flush_rate > 0)
+    {
+        pager_start_flusher(pager, flush_rate);
+    }
+    *needed_pages = pager->num_pages;
+    return DB_OK;
+}
+static int legacy_cell_compare(const void *a, const void *b)
+{
+    uint32_t left = *(uint32_t *)(*(void *const *)a + LEAF_NODE_KEY_OFFSET);
+    uint32_t right = *(uint32_t *)(*(void *const *)b + LEAF_NODE_KEY_OFFSET);
+    return (left > right) - (left < right);
+}
+/*
+Files written before the header existed have no magic and hold 4 KiB pages
+from offset 0, root first. Their leaf cells match today's, but internal
+nodes carry no row counts and the node header has a parent pointer where
+max_key now is, so the pages cannot simply be moved down behind a header.
+Instead every leaf's rows are bulk loaded into <file>.migrate, which then
+replaces the file. The old engine could leave stray and duplicated cells
+behind after a split; such a file is refused rather than converted. Files
+in any other format are left for pager_open.
+*/
+static bool pager_migrate_legacy(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return true;
+    }
+    off_t file_length = lseek(fd, 0, SEEK_END);
+    uint8_t *pages = NULL;
+    bool legacy = file_length > 0 && file_length % LEGACY_PAGE_SIZE == 0 &&
+                  file_length <= (off_t)TABLE_MAX_PAGES * LEGACY_PAGE_SIZE;
+    if (legacy)
+    {
+        pages = malloc(file_length);
+        legacy = pread(fd, pages, file_length, 0) == file_length &&
+                 memcmp(pages, PAGER_MAGIC, PAGER_MAGIC_SIZE) != 0 && pages[NODE_TYPE_OFFSET] <= NODE_LEAF &&
+                 pages[IS_ROOT_OFFSET] == 1;
+    }
+    close(fd);
+    if (!legacy)
+    {
+        free(pages);
+        return true;
+    }
+
+    uint32_t num_pages = file_length / LEGACY_PAGE_SIZE;
+    uint32_t max_cells = (LEGACY_PAGE_SIZE - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_CELL_SIZE;
+    void **cells = malloc(num_pages * max_cells * sizeof(void *));
+    uint32_t num_rows = 0;
+    for (uint32_t page_num = 0; page_num < num_pages; page_num++)
+    {
+        void *page = pages + page_num * LEGACY_PAGE_SIZE;
+        if (get_node_type(page) != NODE_LEAF)
+        {
+            continue;
+        }
+        for (uint32_t cell_num = 0; cell_num < *leaf_node_num_cells(page) && cell_num < max_cells; cell_num++)
+        {
+            cells[num_rows++] = leaf_node_cell(page, cell_num);
+        }
+    }
+    qsort(cells, num_rows, sizeof(void *), legacy_cell_compare);
+    for (uint32_t row = 1; row < num_rows; row++)
+    {
+        if (legacy_cell_compare(&cells[row - 1], &cells[row]) == 0)
+        {
+            set_open_error("Corrupt file in the old unversioned format.");
+            free(cells);
+            free(pages);
+            return false;
+        }
+    }
+
+    char *migrate_filename = malloc(strlen(filename) + strlen(".migrate") + 1);
+    sprintf(migrate_filename, "%s.migrate", filename);
+    unlink(migrate_filename);
+    DbConfig config = {0};
+    config.page_size = LEGACY_PAGE_SIZE;
+    Pager *pager = pager_open(migrate_filename, &config);
+    bool migrated = pager != NULL;
+    if (migrated)
+    {
+        uint32_t num_leaves =
+            num_rows == 0 ? 1 : (num_rows + pager->leaf_node_max_cells - 1) / pager->leaf_node_max_cells;
+        bulk_load(pager, cells, num_rows, num_leaves);
+        pager_checkpoint(pager);
+        pager_free(pager);
+        if (rename(migrate_filename, filename) == -1)
+        {
+            set_open_error("Unable to replace the database file.");
+            migrated = false;
+        }
+    }
+    free(migrate_filename);
+    free(cells);
+    free(pages);
+    return migrated;
+}
+static uint32_t table_count(Table *table)
+{
+    return node_row_count(get_page(table->pager, table->root_page_num));
+}
+/*
+Positions a cursor on the row at the given 0-based position by skipping
+whole subtrees using the per-child row counts, so the cost is one descent.
+*/
+static Cursor *table_find_position(Table *table, uint32_t position)
+{
+    uint32_t page_num = table->root_page_num;
+    void *node = get_page(table->pager, page_num);
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->depth = 0;
+    while (get_node_type(node) == NODE_INTERNAL)
+    {
+        uint32_t num_keys = *internal_node_num_key(node);
+        uint32_t child_index = 0;
+        while (child_index < num_keys && position >= *internal_node_count(node, child_index))
+        {
+            position -= *internal_node_count(node, child_index);
+            child_index++;
+        }
+        cursor->path[cursor->depth] = page_num;
+        cursor->path_index[cursor->depth] = child_index;
+        cursor->depth++;
+        page_num = *internal_node_child(node, child_index);
+        node = get_page(table->pager, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = position;
+    cursor->end_of_table = position >= *leaf_node_num_cells(node);
+    return cursor;
+}
+/*
+Number of rows before the cursor: the counts of every subtree left of its
+descent path plus its position inside the leaf.
+*/
+static uint32_t cursor_rank(Cursor *cursor)
+{
+    uint32_t rank = cursor->cell_num;
+    for (uint32_t level = 0; level < cursor->depth; level++)
+    {
+        void *node = get_page(cursor->table->pager, cursor->path[level]);
+        for (uint32_t i = 0; i < cursor->path_index[level]; i++)
+        {
+            rank += *internal_node_count(node, i);
+        }
+    }
+    return rank;
+}
+
+DbResult db_insert(Table *table, const Row *row, DbInsertInfo *info)
+{
+    if (table->read_only)
+    {
+        return DB_READ_ONLY;
+    }
+    pager_lock(table->pager);
+    Cursor *cursor = table_find(table, row->id);
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == row->id)
+    {
+        free(cursor);
+        pager_unlock(table->pager);
+        return DB_DUPLICATE_KEY;
+    }
+    if (info != NULL)
+    {
+        info->cell_num = cursor->cell_num;
+        info->split = *leaf_node_num_cells(node) >= table->pager->leaf_node_max_cells;
+    }
+    leaf_node_insert(cursor, row->id, (Row *)row);
+    table->generation++;
+    free(cursor);
+    pager_unlock(table->pager);
+    replication_publish(table);
+    return DB_OK;
+}
+DbResult db_lookup(Table *table, uint32_t id, Row *row)
+{
+    DbResult result = DB_NOT_FOUND;
+    pager_lock(table->pager);
+    Cursor *cursor = table_find(table, id);
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == id)
+    {
+        deserialize_row(leaf_node_value(node, cursor->cell_num), row);
+        result = DB_OK;
+    }
+    free(cursor);
+    pager_unlock(table->pager);
+    return result;
+}
+/*
+Moves a scan cursor past exhausted leaves onto the next row, if any, and
+returns its leaf.
+*/
+static void *scan_cursor_settle(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    void *node = get_page(pager, cursor->page_num);
+    while (!cursor->end_of_table && cursor->cell_num >= *leaf_node_num_cells(node))
+    {
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0)
+        {
+            cursor->end_of_table = true;
+            break;
+        }
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+        node = get_page(pager, next_page_num);
+    }
+    return node;
+}
+/*
+Scan cursors remember the table generation they were positioned in and the
+id to continue from. Any change to the table, including a batch applied on
+a replica, bumps the generation, and the cursor then seeks back to that id
+instead of following pages that may have been split or replaced.
+*/
+static Cursor *scan_cursor_open(Table *table, Cursor *cursor)
+{
+    cursor->end_of_table = false;
+    void *node = scan_cursor_settle(cursor);
+    cursor->generation = table->generation;
+    cursor->resume_id = cursor->end_of_table ? (uint64_t)UINT32_MAX + 1 : *leaf_node_key(node, cursor->cell_num);
+    return cursor;
+}
+Cursor *db_scan(Table *table, uint32_t start_id)
+{
+    pager_lock(table->pager);
+    Cursor *cursor = scan_cursor_open(table, table_find(table, start_id));
+    pager_unlock(table->pager);
+    return cursor;
+}
+Cursor *db_scan_position(Table *table, uint32_t position)
+{
+    pager_lock(table->pager);
+    Cursor *cursor = scan_cursor_open(table, table_find_position(table, position));
+    pager_unlock(table->pager);
+    return cursor;
+}
+DbResult db_rank(Table *table, uint32_t id, uint32_t *rank)
+{
+    DbResult result = DB_NOT_FOUND;
+    pager_lock(table->pager);
+    Cursor *cursor = table_find(table, id);
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == id)
+    {
+        result = DB_OK;
+    }
+    *rank = cursor_rank(cursor);
+    free(cursor);
+    pager_unlock(table->pager);
+    return result;
+}
+bool db_cursor_next(Cursor *cursor, Row *row)
+{
+    Table *table = cursor->table;
+    pager_lock(table->pager);
+    if (cursor->generation != table->generation && cursor->resume_id <= UINT32_MAX)
+    {
+        Cursor *fresh = table_find(table, cursor->resume_id);
+        fresh->end_of_table = false;
+        fresh->resume_id = cursor->resume_id;
+        *cursor = *fresh;
+        free(fresh);
+    }
+    cursor->generation = table->generation;
+    void *node = scan_cursor_settle(cursor);
+    bool found = !cursor->end_of_table && cursor->resume_id <= UINT32_MAX;
+    if (found)
+    {
+        deserialize_row(leaf_node_value(node, cursor->cell_num), row);
+        cursor->resume_id = (uint64_t)row->id + 1;
+        cursor_advance(cursor);
+    }
+    pager_unlock(table->pager);
+    return found;
+}
+void db_cursor_close(Cursor *cursor)
+{
+    free(cursor);
+}
+uint32_t db_count(Table *table)
+{
+    pager_lock(table->pager);
+    uint32_t count = table_count(table);
+    pager_unlock(table->pager);
+    return count;
+}
+DbResult db_min_id(Table *table, uint32_t *id)
+{
+    DbResult result = DB_NOT_FOUND;
+    pager_lock(table->pager);
+    Cursor *cursor = table_start(table);
+    void *leaf = get_page(table->pager, cursor->page_num);
+    if (*leaf_node_num_cells(leaf) > 0)
+    {
+        *id = *leaf_node_key(leaf, 0);
+        result = DB_OK;
+    }
+    free(cursor);
+    pager_unlock(table->pager);
+    return result;
+}
+DbResult db_max_id(Table *table, uint32_t *id)
+{
+    pager_lock(table->pager);
+    void *root = get_page(table->pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    *id = get_node_max_key(root);
+    pager_unlock(table->pager);
+    return empty ? DB_NOT_FOUND : DB_OK;
+}
+void db_checkpoint(Table *table)
+{
+    pager_checkpoint(table->pager);
+}
+DbResult db_vacuum(Table *table, uint32_t fill_percent, uint32_t *num_pages)
+{
+    if (table->read_only)
+    {
+        return DB_READ_ONLY;
+    }
+    if (table->replication != NULL)
+    {
+        pthread_mutex_lock(&table->replication->lock);
+    }
+    DbResult result = table_vacuum(table, fill_percent, num_pages);
+    if (table->replication != NULL)
+    {
+        pthread_mutex_unlock(&table->replication->lock);
+        replication_publish(table);
+    }
+    return result;
+}
+void db_print_tree(Table *table)
+{
+    pager_lock(table->pager);
+    print_tree(table->pager, table->root_page_num, 0);
+    pager_unlock(table->pager);
+}
+void db_print_constants(Table *table)
+{
+    print_constants(table->pager);
+}
+typedef struct
+{
+    Row row;
+    uint32_t run;
+} SortEntry;
+struct Sorter
+{
+    DbColumn column;
+    uint32_t limit;
+    uint32_t returned;
+    Row *rows;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t position;
+    FILE **runs;
+    uint32_t num_runs;
+    SortEntry *heap;
+    uint32_t heap_size;
+};
+
+static int sort_compare(const Row *a, const Row *b, DbColumn column)
+{
+    int result = 0;
+    if (column == DB_COLUMN_USERNAME)
+    {
+        result = strcmp(a->username, b->username);
+    }
+    else if (column == DB_COLUMN_EMAIL)
+    {
+        result = strcmp(a->email, b->email);
+    }
+    if (result == 0)
+    {
+        result = (a->id > b->id) - (a->id < b->id);
+    }
+    return result;
+}
+static int sort_compare_rows(const void *a, const void *b, void *column)
+{
+    return sort_compare(a, b, *(DbColumn *)column);
+}
+/*
+direction is 1 for a min-heap (merging runs) and -1 for a max-heap (keeping
+the smallest limit rows).
+*/
+static void sort_heap_sift_down(SortEntry *heap, uint32_t size, uint32_t index, DbColumn column, int direction)
+{
+    while (true)
+    {
+        uint32_t top = index;
+        uint32_t left = 2 * index + 1;
+        uint32_t right = left + 1;
+        if (left < size && sort_compare(&heap[left].row, &heap[top].row, column) * direction < 0)
+        {
+            top = left;
+        }
+        if (right < size && sort_compare(&heap[right].row, &heap[top].row, column) * direction < 0)
+        {
+            top = right;
+        }
+        if (top == index)
+        {
+            return;
+        }
+        SortEntry swap = heap[index];
+        heap[index] = heap[top];
+        heap[top] = swap;
+        index = top;
+    }
+}
+static void sort_heap_sift_up(SortEntry *heap, uint32_t index, DbColumn column, int direction)
+{
+    while (index > 0)
+    {
+        uint32_t parent = (index - 1) / 2;
+        if (sort_compare(&heap[index].row, &heap[parent].row, column) * direction >= 0)
+        {
+            return;
+        }
+        SortEntry swap = heap[index];
+        heap[index] = heap[parent];
+        heap[parent] = swap;
+        index = parent;
+    }
+}
+static void sort_spill_run(Sorter *sorter)
+{
+    qsort_r(sorter->rows, sorter->count, sizeof(Row), sort_compare_rows, &sorter->column);
+    FILE *run = tmpfile();
+    if (run == NULL || fwrite(sorter->rows, sizeof(Row), sorter->count, run) != sorter->count)
+    {
+        printf("Unable to write sort run.\n");
+        exit(EXIT_FAILURE);
+    }
+    rewind(run);
+    sorter->runs = realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(FILE *));
+    sorter->runs[sorter->num_runs++] = run;
+    sorter->count = 0;
+}
+static void sort_add(Sorter *sorter, Row *row)
+{
+    if (sorter->heap != NULL)
+    {
+        if (sorter->heap_size < sorter->limit)
+        {
+            sorter->heap[sorter->heap_size].row = *row;
+            sort_heap_sift_up(sorter->heap, sorter->heap_size++, sorter->column, -1);
+        }
+        else if (sort_compare(row, &sorter->heap[0].row, sorter->column) < 0)
+        {
+            sorter->heap[0].row = *row;
+            sort_heap_sift_down(sorter->heap, sorter->heap_size, 0, sorter->column, -1);
+        }
+        return;
+    }
+    if (sorter->count == sorter->capacity)
+    {
+        sort_spill_run(sorter);
+    }
+    sorter->rows[sorter->count++] = *row;
+}
+static void sort_finish(Sorter *sorter)
+{
+    if (sorter->heap != NULL)
+    {
+        sorter->rows = malloc(sorter->heap_size * sizeof(Row));
+        for (uint32_t i = 0; i < sorter->heap_size; i++)
+        {
+            sorter->rows[i] = sorter->heap[i].row;
+        }
+        sorter->count = sorter->heap_size;
+        free(sorter->heap);
+        sorter->heap = NULL;
+        sorter->heap_size = 0;
+    }
+    else if (sorter->num_runs > 0)
+    {
+        if (sorter->count > 0)
+        {
+            sort_spill_run(sorter);
+        }
+        sorter->heap = malloc(sorter->num_runs * sizeof(SortEntry));
+        for (uint32_t run = 0; run < sorter->num_runs; run++)
+        {
+            if (fread(&sorter->heap[sorter->heap_size].row, sizeof(Row), 1, sorter->runs[run]) == 1)
+            {
+                sorter->heap[sorter->heap_size++].run = run;
+            }
+        }
+        for (uint32_t i = sorter->heap_size / 2; i > 0; i--)
+        {
+            sort_heap_sift_down(sorter->heap, sorter->heap_size, i - 1, sorter->column, 1);
+        }
+        return;
+    }
+    qsort_r(sorter->rows, sorter->count, sizeof(Row), sort_compare_rows, &sorter->column);
+}
+/*
+Rows are collected into a buffer of SORT_MEMORY_BUDGET bytes. Each time it
+fills, it is sorted and spilled to a temporary file as a run, and the runs
+are merged through a min-heap while iterating. With a limit that fits the
+budget, a max-heap of the limit smallest rows is kept instead and nothing
+is spilled.
+*/
+Sorter *db_sort(Table *table, DbColumn column, uint32_t limit)
+{
+    Sorter *sorter = calloc(1, sizeof(Sorter));
+    sorter->column = column;
+    sorter->limit = limit;
+    sorter->capacity = SORT_MEMORY_BUDGET / sizeof(Row);
+    if (sorter->capacity == 0)
+    {
+        sorter->capacity = 1;
+    }
+    if (limit > 0 && limit <= sorter->capacity)
+    {
+        sorter->heap = malloc(limit * sizeof(SortEntry));
+    }
+    else
+    {
+        sorter->rows = malloc(sorter->capacity * sizeof(Row));
+    }
+
+    pager_lock(table->pager);
+    Cursor *cursor = table_start(table);
+    Row row;
+    while (!cursor->end_of_table)
+    {
+        deserialize_row(cursor_value(cursor), &row);
+        sort_add(sorter, &row);
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    pager_unlock(table->pager);
+    sort_finish(sorter);
+    return sorter;
+}
+bool db_sort_next(Sorter *sorter, Row *row)
+{
+    if (sorter->limit > 0 && sorter->returned == sorter->limit)
+    {
+        return false;
+    }
+    if (sorter->num_runs == 0)
+    {
+        if (sorter->position == sorter->count)
+        {
+            return false;
+        }
+        *row = sorter->rows[sorter->position++];
+    }
+    else
+    {
+        if (sorter->heap_size == 0)
+        {
+            return false;
+        }
+        *row = sorter->heap[0].row;
+        if (fread(&sorter->heap[0].row, sizeof(Row), 1, sorter->runs[sorter->heap[0].run]) != 1)
+        {
+            sorter->heap[0] = sorter->heap[--sorter->heap_size];
+        }
+        sort_heap_sift_down(sorter->heap, sorter->heap_size, 0, sorter->column, 1);
+    }
+    sorter->returned++;
+    return true;
+}
+void db_sort_close(Sorter *sorter)
+{
+    for (uint32_t run = 0; run < sorter->num_runs; run++)
+    {
+        fclose(sorter->runs[run]);
+    }
+    free(sorter->runs);
+    free(sorter->heap);
+    free(sorter->rows);
+    free(sorter);
+}
+void db_statement_begin(void)
+{
+    trace_ring.statement++;
+    TRACE(TRACE_STATEMENT_BEGIN, statement_begin, trace_ring.statement, 0);
+}
+void db_statement_end(void)
+{
+    TRACE(TRACE_STATEMENT_END, statement_end, trace_ring.statement, 0);
+}
+void db_trace_enable(bool enabled)
+{
+    if (enabled && !__atomic_load_n(&trace_ring.enabled, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&trace_ring.next, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&trace_ring.enabled, enabled, __ATOMIC_RELEASE);
+}
+/*
+Prints the ring oldest first. Events inside a statement are indented and
+timed from its begin event; anything else, such as background flushes, is
+timed from the previous event.
+*/
+void db_trace_dump(void)
+{
+    uint64_t end = __atomic_load_n(&trace_ring.next, __ATOMIC_ACQUIRE);
+    uint64_t start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+    uint64_t base_ns = 0;
+    bool in_statement = false;
+    for (uint64_t i = start; i < end; i++)
+    {
+        TraceEvent *event = &trace_ring.events[i % TRACE_RING_SIZE];
+        if (event->type == TRACE_STATEMENT_BEGIN || (!in_statement && base_ns == 0))
+        {
+            base_ns = event->time_ns;
+        }
+        bool nested = in_statement && event->type != TRACE_STATEMENT_END;
+        printf("%s%-16s %8u %8u  +%lluus\n", nested ? "  " : "", TRACE_EVENT_NAMES[event->type], event->arg1,
+               event->arg2, (unsigned long long)(event->time_ns - base_ns) / 1000);
+        if (event->type == TRACE_STATEMENT_BEGIN)
+        {
+            in_statement = true;
+        }
+        else if (event->type == TRACE_STATEMENT_END)
+        {
+            in_statement = false;
+        }
+        if (!in_statement)
+        {
+            base_ns = event->time_ns;
+        }
+    }
+    if (start > 0)
+    {
+        printf("(%llu older events overwritten)\n", (unsigned long long)start);
+    }
+}
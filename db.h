@@ -0,0 +1,122 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COL_USERNAME_SIZE 32
+#define COL_EMAIL_SIZE 255
+
+typedef struct
+{
+    uint32_t id;
+    char username[COL_USERNAME_SIZE + 1];
+    char email[COL_EMAIL_SIZE + 1];
+} Row;
+typedef struct
+{
+    bool compress;
+    bool direct_io;
+    uint32_t page_size;
+    uint32_t flush_rate;
+    const char *replicate_path;
+    const char *follow_path;
+} DbConfig;
+typedef enum
+{
+    DB_OK,
+    DB_DUPLICATE_KEY,
+    DB_NOT_FOUND,
+    DB_READ_ONLY,
+    DB_TABLE_FULL
+} DbResult;
+typedef enum
+{
+    DB_COLUMN_ID,
+    DB_COLUMN_USERNAME,
+    DB_COLUMN_EMAIL
+} DbColumn;
+
+typedef struct
+{
+    uint32_t cell_num;
+    bool split;
+} DbInsertInfo;
+
+typedef struct Table Table;
+typedef struct Cursor Cursor;
+typedef struct Sorter Sorter;
+
+/*
+Opens or creates the database file. A zeroed DbConfig gives the defaults.
+Every call below is safe to use alongside the background flusher and
+replication threads.
+Returns NULL if the file cannot be opened or the options are invalid;
+db_open_error then describes the failure.
+*/
+Table *db_open(const char *filename, const DbConfig *config);
+const char *db_open_error(void);
+void db_close(Table *table);
+
+/*
+info may be NULL; otherwise it reports the leaf cell the row went to and
+whether the leaf had to split to take it.
+*/
+DbResult db_insert(Table *table, const Row *row, DbInsertInfo *info);
+DbResult db_lookup(Table *table, uint32_t id, Row *row);
+
+/*
+Returns a cursor positioned at the first row with id >= start_id.
+db_cursor_next copies the row out and returns false past the last row.
+If the table changes between calls, through a write or a batch applied on
+a replica, the cursor carries on from the row after the last one it
+returned, so rows still come out in id order and never twice.
+*/
+Cursor *db_scan(Table *table, uint32_t start_id);
+/*
+Returns a cursor positioned at the row with the given 0-based position in id
+order. Internal nodes keep per-child row counts, so this is one descent.
+*/
+Cursor *db_scan_position(Table *table, uint32_t position);
+bool db_cursor_next(Cursor *cursor, Row *row);
+void db_cursor_close(Cursor *cursor);
+
+/*
+Returns the rows ordered by column, ties broken by id, stopping after limit
+rows unless limit is 0. Sorting spills to temporary files past a fixed
+memory budget.
+*/
+Sorter *db_sort(Table *table, DbColumn column, uint32_t limit);
+bool db_sort_next(Sorter *sorter, Row *row);
+void db_sort_close(Sorter *sorter);
+
+uint32_t db_count(Table *table);
+/*
+Sets rank to the number of rows with a smaller id. DB_NOT_FOUND if the id
+itself is absent; rank is then where it would be inserted.
+*/
+DbResult db_rank(Table *table, uint32_t id, uint32_t *rank);
+DbResult db_min_id(Table *table, uint32_t *id);
+DbResult db_max_id(Table *table, uint32_t *id);
+
+void db_checkpoint(Table *table);
+/*
+Rebuilds the table with leaves filled to fill_percent and sets num_pages to
+its new size. DB_TABLE_FULL, with num_pages set to the pages it would need,
+when the rebuild does not fit; the table is then unchanged.
+*/
+DbResult db_vacuum(Table *table, uint32_t fill_percent, uint32_t *num_pages);
+
+void db_print_tree(Table *table);
+void db_print_constants(Table *table);
+
+/*
+Statement boundaries for the trace points. The trace ring holds the most
+recent events while enabled; db_trace_dump prints it to stdout.
+*/
+void db_statement_begin(void);
+void db_statement_end(void);
+void db_trace_enable(bool enabled);
+void db_trace_dump(void);
+
+#endif